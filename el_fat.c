@@ -68,9 +68,10 @@ typedef enum
 /* 定义首目录簇开始扇区 */
 //static unsigned int FirstDirSector = 0;/* 此变量可删除？不清楚，在这个文件系统编写早期定义的，已经忘了干什么用的了 */
 
+/* 扇区大小，挂载时取自DBR中的bytsPerSec，缓冲区按MAX_SECSIZE分配 */
+static unsigned short g_secsz = 512;
+#define PER_SECSIZE g_secsz
 /* 固定参数begin，不能改 */
-/* 定义FAT32扇区大小，固定为512Byte */
-#define PER_SECSIZE 512
 /* 定义根目录簇簇号 */
 #define ROOT_CLUS   2
 /* 定义每个FAT文件系统对象最大分区数 */
@@ -168,6 +169,9 @@ typedef struct FileSystemInfoStruct
     J_UINT8 Next_Free_Clus[4];//下一个剩余空簇
     J_UINT8 Resv2[14];
     J_UINT8 FixTail[2];//"55 AA"
+#if MAX_SECSIZE > 512
+    J_UINT8 Resv3[MAX_SECSIZE-512];//大扇区时的扇区剩余部分
+#endif
 }FSINFO_t;
 
 typedef enum
@@ -225,7 +229,7 @@ typedef struct
 /* 一个扇区内的FDI */
 typedef struct FDIInOneSec
 {
-    FDI_t fdi[PER_SECSIZE/sizeof(FDI_t)];
+    FDI_t fdi[MAX_SECSIZE/sizeof(FDI_t)];
 }FDIs_t;
 
 /* 全局MBR DBR */
@@ -260,9 +264,16 @@ typedef struct fileHandler
     unsigned int fl_sz;
     /* 文件状态 */
     FILE_STATE file_state;
+#if YC_FAT_DIRECT_IO
+    unsigned char oflag;/* 打开标志 */
+#endif
 #if YC_FILE2MEM
     int (*load2memory)(struct fileHandler *,void *mem_base,int);/* 文件是否加载至内存操作 */
     int (*Writeback)(struct fileHandler *,void *mem_base,int);/* 文件回写 */
+    unsigned char *mem;         /* 文件内存映像，NULL表示未加载 */
+    unsigned char *mem_dirty;   /* 脏扇区位图 */
+    unsigned char mem_own;      /* 映像内存由库从堆中分配 */
+    unsigned int mem_secs;      /* 映像扇区数，加载时的文件扇区数 */
 #endif
     struct list_head WRCluChainList;/* 簇链缓冲头节点，不携带实际数据 */
     struct list_head RDCluChainList;/* 簇链缓冲头节点，不携带实际数据 */
@@ -273,6 +284,20 @@ typedef struct fileHandler
 	unsigned int CurClus;/* 暂时没用 */
     /* 文件末簇未写大小 */
     unsigned int EndCluLeftSize;
+#if YC_FAT_PREALLOC
+    /* 预分配簇，链接在文件尾簇之后，不计入文件大小 */
+    unsigned int PreClu;    /* 第一个预分配簇 */
+    unsigned int PreEnd;    /* 最后一个预分配簇 */
+    unsigned int PreNum;    /* 预分配簇数，0表示无 */
+    unsigned int PreTaken;  /* 本次写入取用的预分配簇数 */
+#endif
+#if YC_FAT_DELALLOC
+    /* 延迟分配暂存区，追加写的数据先暂存，下发时才分配簇 */
+    unsigned char *da_buf;  /* 暂存区，NULL表示未开启 */
+    unsigned int da_sz;     /* 暂存区大小 */
+    unsigned int da_len;    /* 已暂存字节数，不计入fl_sz */
+    unsigned char da_own;   /* 暂存区由库从堆中分配 */
+#endif
 	
     /* 文件FDI所在扇区及其偏移 */
     struct fdi_info {
@@ -304,30 +329,63 @@ typedef struct FAT_Table
 
 typedef struct FAT_TableSector
 {
-    FAT32_t fat_sec[PER_SECSIZE/FAT_SIZE];//128
+    FAT32_t fat_sec[MAX_SECSIZE/FAT_SIZE];//512B扇区时128
 }FAT32_Sec_t;
 
-static unsigned int open_sem = MAX_OPEN_FILES;
 #if MAX_OPEN_FILES
+/* 打开文件表，按FDI位置(fdi_sec,fdi_off)散列，同一文件的多个句柄共用一个表项 */
 typedef struct {
     unsigned int ffdi_sec;
     unsigned short ffdi_off;
-    char is_open;
+    unsigned short ref;         /* 打开此文件的句柄数，0表示表项空闲 */
+    unsigned short next;        /* 散列链或空闲链中的下一表项（下标+1），0表示结束 */
+#if OPEN_EXTENTS
+    unsigned short ext_n;       /* 共享区段表项数，0表示未建立，OPEN_EXT_NONE表示段数过多不建立 */
+    struct {
+        unsigned int clu;       /* 区段首簇 */
+        unsigned int num;       /* 区段簇数 */
+    }ext[OPEN_EXTENTS];         /* 簇链区段表，同一文件的所有句柄共用 */
+#endif
 }Match_Info_t;
-static Match_Info_t matchInfo[MAX_OPEN_FILES] = {0};
+static Match_Info_t matchInfo[MAX_OPEN_FILES];
+static unsigned short open_hash[OPEN_HASH_SIZE];/* 散列桶，存放表项下标+1 */
+static unsigned short open_free = 0;/* 空闲链表头 */
+static unsigned short open_used = 0;/* 已启用过的表项数 */
+/* FDI为32字节，同一扇区内的FDI按偏移依次散列 */
+#define OPEN_HASH(sec,off) ((((sec) << 4) + ((off) >> 5)) & (OPEN_HASH_SIZE-1))
+#define OPEN_EXT_NONE 0xffff
 #endif
 
 #if FILE_CACHE
-/* 文件缓存数据结构 */
+/* 文件信息缓存表项，按FDI位置(fdi_sec,fdi_off)散列，满时淘汰最久未用的表项 */
 typedef struct {
-    /* 文件FDI所在扇区及其偏移 */
-    struct fdi_info_c {
-        unsigned int fdi_sec_c;
-        unsigned short fdi_off_c;
-    }fdi_info_c_t;
-    unsigned int tail_cluster;
+    unsigned int fdi_sec;       /* 0表示表项空闲 */
+    unsigned short fdi_off;
+    unsigned short hnext;       /* 散列链中的下一表项（下标+1），0表示结束 */
+    unsigned short prev,next;   /* LRU链（下标+1），链头为最近使用 */
+    unsigned int first_clu;     /* 首簇 */
+    unsigned int tail_clu;      /* 尾簇 */
+    unsigned int fl_sz;         /* 记录尾簇时的文件大小 */
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    unsigned short ext_n;       /* 簇链区段数，含义同打开文件表 */
+    struct {
+        unsigned int clu;
+        unsigned int num;
+    }ext[OPEN_EXTENTS];         /* 簇链区段表，重新打开时直接装入打开文件表 */
+#endif
 } FileCacheEntry;
-FileCacheEntry file_cache[MAX_FILES_CACHE];/* 文件缓存区 */
+/* 文件缓存，只含下标不含指针，可整体保存和恢复 */
+static struct {
+    unsigned int magic;
+    unsigned int vol_id;        /* 卷序列号，恢复时校验 */
+    unsigned int fat1sec;
+    unsigned short head,tail;   /* LRU链头尾（下标+1） */
+    unsigned short used;        /* 已启用过的表项数 */
+    unsigned short hash[FCACHE_HASH_SIZE];
+    FileCacheEntry ent[MAX_FILES_CACHE];
+}fcache;
+#define FCACHE_MAGIC 0x59434643 /* "YCFC" */
+#define FCACHE_HASH(sec,off) ((((sec) << 4) + ((off) >> 5)) & (FCACHE_HASH_SIZE-1))
 #endif
 
 typedef enum CreatFDItype
@@ -373,7 +431,7 @@ NorFlashWritePage(uint32_t PageIndex, uint8_t* dBuffer, uint32_t PageNum)//页
 NorFlashWriteSector(uint32_t SectorIndex, uint8_t* dBuffer, uint32_t SectorNum)//扇区写（三个参数分别是，1-第几个扇区 2-数据地址 3-要写入的扇区数）
 NorFlashWriteBlock(uint32_t BlockIndex, uint8_t* dBuffer, uint32_t BlockNum)//块写（三个参数分别是，1-第几个块 2-数据地址 3-要写入的块数）
 NorFlashRead(uint32_t ReadAddr, uint8_t* pBuffer, uint32_t NumByteToRead)//读（三个参数分别是1-读开始地址（以字节为单位） 2-读入地址 3-需要读取的字节数）
-既然你的flash页大小是256B，物理扇区大小是4K，而这个库又是以512B的扇区为单位的，所以出现参数不对应问题，那么有下面两种解决办法：
+既然你的flash页大小是256B，物理扇区大小是4K，而这个库以卷的逻辑扇区为单位（DBR中的每扇区字节数，512B到MAX_SECSIZE），下面以512B逻辑扇区为例，参数不对应时有两种解决办法：
 方法1：把NorFlashWritePage函数封装成以512字节一个扇区的写函数
     比如：
     NorFlashWrite(uint8_t* dBuffer,uint32_t Index, uint32_t Num){
@@ -381,12 +439,44 @@ NorFlashRead(uint32_t ReadAddr, uint8_t* pBuffer, uint32_t NumByteToRead)//读
     }
     这样就变成以512B为一单位写了，再把NorFlashWrite封装在ioopr_t结构体中传入给挂载函数
 方法2：直接把NorFlashWriteSector传入给挂载函数，但是！会造成4K-512B=3.5K每扇区的空间浪费
-同理读操作也是一样你需要把ReadAddr转化为扇区（512B为单位的扇区，不是flash中的物理扇区4K）索引
+同理读操作也是一样你需要把ReadAddr转化为扇区（逻辑扇区，不是flash中的物理扇区4K）索引
+若卷格式化为4K逻辑扇区（4Kn），读写函数直接以4K为单位，不会浪费空间
+EraseBlkSecs始终以512B为单位填写，挂载时按逻辑扇区大小换算
 */
+#if YC_FAT_ASYNC_IO
+/* 异步传输完成回调，由底层在DMA传输完成中断中调用，status非0表示传输出错 */
+typedef void (*io_cplt_t)(void *arg,char status);
+#endif
+#if YC_FAT_VECTOR_IO
+/* 分散/聚集读写段 */
+typedef struct {
+	void * buffer;//数据缓冲区
+	unsigned int SecIndex;//起始扇区
+	unsigned int SecNum;//扇区数
+}io_seg_t;
+#endif
 typedef struct {
 	char (*DeviceOpr_WR)(void * buffer,unsigned int SecIndex,unsigned int SecNum);//写设备
 	char (*DeviceOpr_RD)(void * buffer,unsigned int SecIndex,unsigned int SecNum);//读设备
 	char (*DeviceOpr_CLR)(unsigned int SecIndex,unsigned int SecNum);//擦除设备
+#if YC_FAT_ASYNC_IO
+	/* 异步读写（可选，为NULL时使用同步读写），提交后立即返回，传输完成后调用cplt */
+	char (*DeviceOpr_WR_Async)(void * buffer,unsigned int SecIndex,unsigned int SecNum,io_cplt_t cplt,void *arg);//异步写设备
+	char (*DeviceOpr_RD_Async)(void * buffer,unsigned int SecIndex,unsigned int SecNum,io_cplt_t cplt,void *arg);//异步读设备
+#endif
+#if YC_FAT_VECTOR_IO
+	/* 分散/聚集读写（可选，为NULL时逐段调用同步读写），一次提交segnum个段，按段表顺序完成后返回 */
+	char (*DeviceOpr_WRV)(io_seg_t *seg,unsigned int segnum);//向量写设备
+	char (*DeviceOpr_RDV)(io_seg_t *seg,unsigned int segnum);//向量读设备
+#endif
+#if FILE_CACHE && FCACHE_PERSIST
+	/* 文件缓存持久化（可选，为NULL时不保存），卸载时保存，下次挂载时读回，返回0表示成功 */
+	char (*CacheSave)(const void * buffer,unsigned int size);//保存文件缓存
+	char (*CacheLoad)(void * buffer,unsigned int size);//读回文件缓存
+#endif
+#if YC_FAT_ERASE_ALIGN
+	unsigned int EraseBlkSecs;//擦除块大小（以512B扇区为单位），如4K擦除扇区的NOR Flash填8，0或1表示不对齐
+#endif
 }ioopr_t;
 
 /* 文件系统实例 */
@@ -435,6 +525,8 @@ union e_cont
 #define CLU_TO_FATSEC(clu) ((clu * FAT_SIZE / PER_SECSIZE) + FatInitArgs_a[0].FAT1Sec)
 /* 由簇号到扇区映射 */
 #define START_SECTOR_OF_FILE(clu) (((clu-2)*g_dbr[0].secPerClus)+FatInitArgs_a[0].FirstDirSector)
+/* 数据区簇号上限（不含），由DBR总扇区数扣除保留区和FAT表得到 */
+#define CLU_END() ((g_dbr[0].totSec32-(FatInitArgs_a[0].FirstDirSector-FatInitArgs_a[0].FAT1Sec+g_dbr[0].rsvdSecCnt))/g_dbr[0].secPerClus+2)
 /* 由簇号得其FAT所在扇区内偏移 */
 #define TAKE_FAT_OFF(clu) ((clu * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE
 /* 检查文件信息中的文件属性字段 */
@@ -466,12 +558,30 @@ union e_cont
 #define ENTER_DIR_ERROR -3
 /* 关闭文件错误 */
 #define CLOSE_HOLE_FILE_ERR -1
+#define CLOSE_NOT_OPEN_ERR -2
+#if YC_FAT_ASYNC_IO
+/* 异步读写错误码 */
+#define AIO_BUSY_ERR -5
+#define AIO_DEVICE_ERR -6
+#endif
 /* 写文件错误码 */
 #define WRITE_FILE_PARAM_ERR -1
 #define WRITE_FILE_CLOSED_ERR -2
 #define WRITE_FILE_LENGTH_WARN -3
+#if YC_FILE2MEM
+#define WRITE_FILE_MEM_ERR -7 /* 文件已加载至内存，须先回写并释放映像 */
+#endif
 /* 删除文件错误码 */
 #define DEL_FILE_OPENED_ERR -1
+/* 初始化错误码 */
+#define INIT_SECSIZE_ERR -3 /* 扇区大小不支持，大于MAX_SECSIZE时需调大配置 */
+#if YC_FAT_DIRECT_IO
+/* 文件打开标志 */
+#define YC_O_NORMAL 0x00
+#define YC_O_DIRECT 0x01 /* 直接I/O，读写偏移和长度必须扇区对齐 */
+/* 直接I/O错误码 */
+#define DIRECT_IO_ALIGN_ERR -4
+#endif
 #if YC_FAT_MKFS
 /* 格式化错误码 */
 #define NOTSUPPORTED_SIZE -1
@@ -504,29 +614,38 @@ union e_cont
 #define SET_BIT(a,n) (a = a|(1<<n))/* a的第n位置1 */
 struct list_head ycfatBlockHead;/* 挂载链头节点，不携带实际数据 */
 static char fatobjNodeNum = 0;
+#if YC_FAT_ASYNC_IO || YC_FAT_VECTOR_IO
+/* 当前挂载设备的底层实现集，异步读写和向量读写用 */
+static ioopr_t *cur_ioopr = NULL;
+#endif
+#if YC_FAT_ERASE_ALIGN
+/* 当前挂载设备的擦除块大小，erase_blk512以512B为单位（ioopr_t.EraseBlkSecs），erase_blk换算为逻辑扇区数 */
+/* 0或1表示不按擦除块对齐，设置扇区大小时重新换算 */
+static unsigned int erase_blk512 = 0,erase_blk = 0;
+#endif
 // bit map for FAT table
 /* 只定义一个位图，不支持多磁盘分区 */
 /* FAT进行位图映射时，直接将FAT值和0作逻辑或运算 */
-uint8_t clusterBitmap[(PER_SECSIZE/FAT_SIZE)/8];//16Bytes
+uint8_t clusterBitmap[(MAX_SECSIZE/FAT_SIZE)/8];//512B扇区时使用16Bytes
 /* 下一个可用FAT所在扇区 */
 static unsigned int cur_fat_sec;
 /* 当前所在目录 */
 static unsigned int work_clu[4] = {2,2,2,2};
 /* 临时交换区,TakeFileClusList_Eftv用 */
-static unsigned char buffer0[PER_SECSIZE];
+static unsigned char buffer0[MAX_SECSIZE];
 /* 临时交换区,写文件用 */
-static unsigned char buffer1[PER_SECSIZE];
-#if FAT2_ENABLE
-/* 临时交换区,FAT2备份用 */
-static unsigned char buffer2[PER_SECSIZE];
+static unsigned char buffer1[MAX_SECSIZE];
+#if FAT2_ENABLE || YC_FAT_RING
+/* 临时交换区,FAT2备份和环形文件用 */
+static unsigned char buffer2[MAX_SECSIZE];
 #endif
 /* 临时交换区,删除文件用 */
-static unsigned char buffer3[PER_SECSIZE];
+static unsigned char buffer3[MAX_SECSIZE];
 #if YC_FAT_MKFS
 /* 临时交换区,格式化用 */
-static unsigned char buffer4[PER_SECSIZE];
+static unsigned char buffer4[MAX_SECSIZE];
 #if FROMAT_STRATEGY_SET == FDISK
-J_ROM_UINT8 temp_fs_mbr[PER_SECSIZE] = {
+J_ROM_UINT8 temp_fs_mbr[512] = {
 	0x02, 0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
@@ -562,7 +681,7 @@ J_ROM_UINT8 temp_fs_mbr[PER_SECSIZE] = {
 };
 #endif
 /* DBR模板 */
-J_ROM_UINT8 temp_fs_dbr[PER_SECSIZE] = {
+J_ROM_UINT8 temp_fs_dbr[512] = {
 	0xEB, 0x58, 0x90, 0x4D, 0x53, 0x44, 0x4F, 0x53, 0x35, 0x2E, 0x30, 0x00, 0x02, 0x08, 0x60, 0x14, 
 	0x02, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x00, 0x00, 0x3F, 0x00, 0xFF, 0x00, 0x20, 0x00, 0x00, 0x00, 
 	0xE0, 0x3F, 0xD8, 0x01, 0xD0, 0x75, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 
@@ -694,6 +813,241 @@ static void YC_MemCpy(unsigned char *_tar, unsigned char *_src, unsigned len) {
     for(;i<len;i++) _tar[i] = _src[i];
 }
 
+/* 设备读写层，库内所有扇区读写都经过这里 */
+#if YC_FAT_WRQUEUE
+/* 元数据写队列，按LBA升序存放，数据按实际扇区大小连续存放以便相邻扇区合并为一次多扇区写 */
+static unsigned int wrq_lba[WRQUEUE_DEPTH];
+static unsigned char wrq_buf[WRQUEUE_DEPTH*MAX_SECSIZE];
+#define WRQ_BUF(i) (wrq_buf+(i)*PER_SECSIZE)
+static unsigned char wrq_n = 0;
+
+/* 丢弃队列中落在[SecIndex,SecIndex+SecNum)内的扇区 */
+static void YC_FAT_QueueDrop(unsigned int SecIndex,unsigned int SecNum)
+{
+    unsigned char i,k = 0;
+    for(i = 0;i < wrq_n;i++)
+    {
+        if((wrq_lba[i] >= SecIndex) && (wrq_lba[i] - SecIndex < SecNum)) continue;
+        if(k != i)
+        {
+            wrq_lba[k] = wrq_lba[i];
+            YC_MemCpy(WRQ_BUF(k),WRQ_BUF(i),PER_SECSIZE);
+        }
+        k++;
+    }
+    wrq_n = k;
+}
+
+/* 将队列中落在[SecIndex,SecIndex+SecNum)内的扇区覆盖到刚读出的数据上 */
+static void YC_FAT_QueueOverlay(void * buffer,unsigned int SecIndex,unsigned int SecNum)
+{
+    unsigned char i;
+    for(i = 0;i < wrq_n;i++)
+    {
+        if((wrq_lba[i] >= SecIndex) && (wrq_lba[i] - SecIndex < SecNum))
+            YC_MemCpy((unsigned char *)buffer+(wrq_lba[i]-SecIndex)*PER_SECSIZE,WRQ_BUF(i),PER_SECSIZE);
+    }
+}
+#endif
+
+/* 读设备，队列中尚未下发的扇区覆盖到读出的数据上 */
+static void YC_FAT_DevRead(void * buffer,unsigned int SecIndex,unsigned int SecNum)
+{
+    usr_read(buffer,SecIndex,SecNum);
+#if YC_FAT_WRQUEUE
+    if(wrq_n) YC_FAT_QueueOverlay(buffer,SecIndex,SecNum);
+#endif
+}
+
+/* 直接写设备，队列中被覆盖的旧扇区一并丢弃 */
+static void YC_FAT_DevWrite(void * buffer,unsigned int SecIndex,unsigned int SecNum)
+{
+#if YC_FAT_WRQUEUE
+    if(wrq_n) YC_FAT_QueueDrop(SecIndex,SecNum);
+#endif
+    usr_write(buffer,SecIndex,SecNum);
+}
+
+#if YC_FAT_VECTOR_IO
+/* 向量读写段表，一次文件读写收集的所有段在这里合并后一次提交 */
+static io_seg_t vec_seg[IOV_MAX_SEGS];
+static unsigned char vec_n = 0;
+static unsigned char vec_wr = 0;/* 0读 1写 */
+
+/* 提交已收集的段，设备未提供向量读写接口时逐段同步读写 */
+static void YC_FAT_VecSubmit(void)
+{
+    unsigned char i;
+    if(!vec_n) return;
+    if(vec_wr)
+    {
+        if((NULL != cur_ioopr) && (NULL != cur_ioopr->DeviceOpr_WRV))
+        {
+#if YC_FAT_WRQUEUE
+            for(i = 0;(i < vec_n) && wrq_n;i++)
+                YC_FAT_QueueDrop(vec_seg[i].SecIndex,vec_seg[i].SecNum);
+#endif
+            cur_ioopr->DeviceOpr_WRV(vec_seg,vec_n);
+        }
+        else
+            for(i = 0;i < vec_n;i++) YC_FAT_DevWrite(vec_seg[i].buffer,vec_seg[i].SecIndex,vec_seg[i].SecNum);
+    }
+    else
+    {
+        if((NULL != cur_ioopr) && (NULL != cur_ioopr->DeviceOpr_RDV))
+        {
+            cur_ioopr->DeviceOpr_RDV(vec_seg,vec_n);
+#if YC_FAT_WRQUEUE
+            for(i = 0;(i < vec_n) && wrq_n;i++)
+                YC_FAT_QueueOverlay(vec_seg[i].buffer,vec_seg[i].SecIndex,vec_seg[i].SecNum);
+#endif
+        }
+        else
+            for(i = 0;i < vec_n;i++) YC_FAT_DevRead(vec_seg[i].buffer,vec_seg[i].SecIndex,vec_seg[i].SecNum);
+    }
+    vec_n = 0;
+}
+
+/* 向段表追加一段，与上一段的LBA和缓冲区都连续时直接合并，段表满或读写方向改变时先提交 */
+static void YC_FAT_VecAdd(unsigned char wr,void * buffer,unsigned int SecIndex,unsigned int SecNum)
+{
+    io_seg_t *seg;
+    if(!SecNum) return;
+    if(vec_n && (vec_wr != wr)) YC_FAT_VecSubmit();
+    vec_wr = wr;
+    if(vec_n)
+    {
+        seg = &vec_seg[vec_n-1];
+        if((seg->SecIndex+seg->SecNum == SecIndex) && \
+            ((unsigned char *)seg->buffer+seg->SecNum*PER_SECSIZE == (unsigned char *)buffer))
+        {
+            seg->SecNum += SecNum;
+            return;
+        }
+    }
+    if(IOV_MAX_SEGS == vec_n) YC_FAT_VecSubmit();
+    vec_seg[vec_n].buffer = buffer;
+    vec_seg[vec_n].SecIndex = SecIndex;
+    vec_seg[vec_n].SecNum = SecNum;
+    vec_n++;
+}
+#define YC_FAT_VecRead(buffer,SecIndex,SecNum) YC_FAT_VecAdd(0,buffer,SecIndex,SecNum)
+#define YC_FAT_VecWrite(buffer,SecIndex,SecNum) YC_FAT_VecAdd(1,buffer,SecIndex,SecNum)
+#else
+#define YC_FAT_VecRead(buffer,SecIndex,SecNum) YC_FAT_DevRead(buffer,SecIndex,SecNum)
+#define YC_FAT_VecWrite(buffer,SecIndex,SecNum) YC_FAT_DevWrite(buffer,SecIndex,SecNum)
+#define YC_FAT_VecSubmit()
+#endif
+
+#if YC_FAT_WRQUEUE
+/* 下发队列中[s,e)的扇区，LBA相邻的扇区合并为一次多扇区写，off为写入时的扇区偏移 */
+static void YC_FAT_FlushRuns(unsigned char s,unsigned char e,unsigned int off)
+{
+    unsigned char i = s,j;
+    while(i < e)
+    {
+        j = i;
+#if YC_FAT_ERASE_ALIGN
+        /* 合并的扇区不跨擦除块，每次写只落在一个擦除块内，底层适配只需一次擦除 */
+        while(((j+1) < e) && (wrq_lba[j+1] == wrq_lba[j]+1) && \
+            ((erase_blk <= 1) || ((wrq_lba[j+1]+off) % erase_blk))) j++;
+#else
+        while(((j+1) < e) && (wrq_lba[j+1] == wrq_lba[j]+1)) j++;
+#endif
+        YC_FAT_VecWrite(WRQ_BUF(i),wrq_lba[i]+off,j-i+1);
+        i = j+1;
+    }
+}
+
+/* 刷新写队列，整个队列作为一次向量写提交 */
+/* 开启FAT2时队列中的FAT1扇区就是本次事务修改过的FAT扇区，紧接着FAT1写入FAT2对应扇区，写入顺序仍按LBA升序 */
+static void YC_FAT_FlushQueue(void)
+{
+    unsigned char n = wrq_n,m = 0;
+#if FAT2_ENABLE
+    unsigned char f = 0;
+#endif
+    wrq_n = 0;/* 先清空队列，下发过程中不再覆盖读出的数据 */
+#if FAT2_ENABLE
+    while((m < n) && (wrq_lba[m] < FatInitArgs_a[0].FAT1Sec+g_dbr[0].FATSz32)) m++;
+    while((f < m) && (wrq_lba[f] < FatInitArgs_a[0].FAT1Sec)) f++;
+    YC_FAT_FlushRuns(0,m,0);/* 保留区和FAT1 */
+    YC_FAT_FlushRuns(f,m,g_dbr[0].FATSz32);/* FAT1脏扇区镜像至FAT2 */
+#endif
+    YC_FAT_FlushRuns(m,n,0);/* 数据区（目录项） */
+    YC_FAT_VecSubmit();
+}
+#endif
+
+/* 元数据单扇区写，入队等待刷新，同一扇区重复写时覆盖队列中的旧数据 */
+static void YC_FAT_QueueWrite(void * buffer,unsigned int SecIndex)
+{
+#if YC_FAT_WRQUEUE
+    unsigned char i,j;
+    for(i = 0;i < wrq_n;i++)
+    {
+        if(wrq_lba[i] == SecIndex)
+        {
+            YC_MemCpy(WRQ_BUF(i),(unsigned char *)buffer,PER_SECSIZE);
+            return;
+        }
+        if(wrq_lba[i] > SecIndex) break;
+    }
+    if(WRQUEUE_DEPTH == wrq_n)
+    {
+        YC_FAT_FlushQueue();/* 队列满，先刷新 */
+        i = 0;
+    }
+    /* 按LBA升序插入 */
+    for(j = wrq_n;j > i;j--)
+    {
+        wrq_lba[j] = wrq_lba[j-1];
+        YC_MemCpy(WRQ_BUF(j),WRQ_BUF(j-1),PER_SECSIZE);
+    }
+    wrq_lba[i] = SecIndex;
+    YC_MemCpy(WRQ_BUF(i),(unsigned char *)buffer,PER_SECSIZE);
+    wrq_n++;
+#else
+    usr_write(buffer,SecIndex,1);
+#if FAT2_ENABLE
+    /* FAT1扇区同步镜像至FAT2 */
+    if((SecIndex >= FatInitArgs_a[0].FAT1Sec) && (SecIndex < FatInitArgs_a[0].FAT1Sec+g_dbr[0].FATSz32))
+        usr_write(buffer,SecIndex+g_dbr[0].FATSz32,1);
+#endif
+#endif
+}
+
+#if YC_FAT_WRQUEUE
+/* 批量事务嵌套深度，非0时YC_FAT_Commit不下发，元数据留在写队列中直到最外层YC_FAT_CommitBatch */
+static unsigned char batch_depth = 0;
+#endif
+
+/* 提交，将写队列中的元数据全部下发至设备，每个写操作结束时调用 */
+static void YC_FAT_Commit(void)
+{
+#if YC_FAT_WRQUEUE
+    if(batch_depth) return;
+    YC_FAT_FlushQueue();
+#endif
+}
+
+#if YC_FAT_WRQUEUE
+/* 开始批量事务，可嵌套 */
+/* 事务内创建、写、关闭等操作修改的目录项、FAT和FSINFO扇区只入队，同一扇区多次修改只保留最后一次 */
+/* 队列满时提前刷新，事务可跨越的扇区数受WRQUEUE_DEPTH限制 */
+void YC_FAT_BeginBatch(void)
+{
+    if(batch_depth < 0xff) batch_depth++;
+}
+
+/* 提交批量事务，最外层提交时队列按LBA升序一次下发，相邻扇区合并为一次多扇区写 */
+void YC_FAT_CommitBatch(void)
+{
+    if(batch_depth && --batch_depth) return;
+    YC_FAT_FlushQueue();
+}
+#endif
+
 /* 解析字符串长度 */
 static unsigned int YC_StrLen(unsigned char *str)
 {
@@ -776,6 +1130,23 @@ static void Value2Byte2(unsigned short *data,unsigned char * des)
     *((unsigned char *)des+1) = *(unsigned short *)data>>8;
 }
 
+/* 将长整型数值转换为4字节，返回des是否被修改 */
+/* 用于扇区读-改-写，内容未变化时调用者跳过回写，NOR Flash上每次少写一个扇区就少一次擦除 */
+static unsigned char Value2Byte4Dirty(unsigned int *data,unsigned char * des)
+{
+    unsigned char tmp[4],i,dirty = 0;
+    Value2Byte4(data,tmp);
+    for(i = 0;i < 4;i++)
+    {
+        if(des[i] != tmp[i])
+        {
+            des[i] = tmp[i];
+            dirty = 1;
+        }
+    }
+    return dirty;
+}
+
 /* 二分查表,数据是char型,必须是升序数列 */
 static int bslp_srch(int NumToSearch,unsigned char *sequence,unsigned int len)
 {
@@ -822,26 +1193,24 @@ static void YC_FAT_ReadDBR(DBR_t * dbr_n)
 {
     DBR_t * dbr = dbr_n;
 	char i;
-    unsigned char buffer[PER_SECSIZE];
+    unsigned char buffer[MAX_SECSIZE];
 
     /* 若没有MBR扇区，则读取绝对0扇区 */
     if(0 == g_dbr_n)
-        usr_read((unsigned char *)buffer,0,1);
+        YC_FAT_DevRead((unsigned char *)buffer,0,1);
     /* 读DBR所在扇区 */
     else
 	{	
 		for(i = 0;i<g_dbr_n;i++)
-		{
-			usr_read((unsigned char *)buffer,g_mbr.dpt[i].partStartSec,1);
-				/* 解析buffer数据 */
-			dbr->bytsPerSec = Byte2Value((unsigned char *)(buffer+11),2); /* 每扇区大小，通常为512 */
-			dbr->secPerClus = Byte2Value((unsigned char *)(buffer+13),1); /* 每簇扇区数 */  
-			dbr->rsvdSecCnt = Byte2Value((unsigned char *)(buffer+14),2); /* 保留扇区数（DBR->FAT1）*/
-			dbr->numFATs = Byte2Value((unsigned char *)(buffer+16),1);  /* FAT表数，通常为2 */
-			dbr->totSec32 = Byte2Value((unsigned char *)(buffer+32),4); /* 总扇区数 */
-			dbr->FATSz32 = Byte2Value((unsigned char *)(buffer+36),4); /* 每个FAT（FAT1或FAT2）表占用的扇区数，FAT32专用 */
-		}
+			YC_FAT_DevRead((unsigned char *)buffer,g_mbr.dpt[i].partStartSec,1);
 	}
+	/* 解析buffer数据，扇区大小在挂载时用于确定PER_SECSIZE（512或4096等） */
+	dbr->bytsPerSec = Byte2Value((unsigned char *)(buffer+11),2); /* 每扇区大小 */
+	dbr->secPerClus = Byte2Value((unsigned char *)(buffer+13),1); /* 每簇扇区数 */  
+	dbr->rsvdSecCnt = Byte2Value((unsigned char *)(buffer+14),2); /* 保留扇区数（DBR->FAT1）*/
+	dbr->numFATs = Byte2Value((unsigned char *)(buffer+16),1);  /* FAT表数，通常为2 */
+	dbr->totSec32 = Byte2Value((unsigned char *)(buffer+32),4); /* 总扇区数 */
+	dbr->FATSz32 = Byte2Value((unsigned char *)(buffer+36),4); /* 每个FAT（FAT1或FAT2）表占用的扇区数，FAT32专用 */
 }
 
 /* 解析绝对0扇区的MBR或DBR */
@@ -849,24 +1218,26 @@ static void YC_FAT_AnalyseSec0(void)
 {
     MBR_t * mbr = (MBR_t *)&g_mbr;
 
-    unsigned char buffer[PER_SECSIZE];
+    unsigned char buffer[MAX_SECSIZE];
 
     /* 读取绝对0扇区 */
-    usr_read(&buffer,0,1);
+    YC_FAT_DevRead(&buffer,0,1);
 
     /* 判断绝对0扇区是不是为MBR扇区 */
     if((*buffer == 0xEB)&&(*(buffer+1) == 0x58)&&(*(buffer+2) == 0x90))
     {
         g_dbr_n = 0;
     }
-
-    /* 解析分区开始扇区和分区所占总扇区数 */
-    for(unsigned char i = 0;i < 4 ; i++)
+    /* 解析分区开始扇区和分区所占总扇区数，绝对0扇区为DBR时该位置是引导代码，不解析 */
+    else
     {
-        if( 0 == *(unsigned int *)(buffer+446+16*i+8) )
-            continue;
-        mbr->dpt[i].partStartSec = Byte2Value((unsigned char *)(buffer+446+16*i+8),4);
-        g_dbr_n ++;
+        for(unsigned char i = 0;i < 4 ; i++)
+        {
+            if( 0 == *(unsigned int *)(buffer+446+16*i+8) )
+                continue;
+            mbr->dpt[i].partStartSec = Byte2Value((unsigned char *)(buffer+446+16*i+8),4);
+            g_dbr_n ++;
+        }
     }
 
     /* DBR初始化 */
@@ -1007,16 +1378,29 @@ static unsigned int YC_TakefileNextClu(unsigned int fl_clus)
     unsigned int t_rSec = off_sec + FatInitArgs_a[0].FAT1Sec; /* 默认取DBR0中的数据 */
 
     /* 取当前扇区所有FAT */
-    usr_read((unsigned char *)&fat_sec,t_rSec,1);
+    YC_FAT_DevRead((unsigned char *)&fat_sec,t_rSec,1);
 
     FAT32_t * fat = (FAT32_t * )&fat_sec.fat_sec[0];
-    unsigned char off_fat = (off_b % PER_SECSIZE)/4;/* 计算在FAT中的偏移（以FAT大小为单位） */
+    unsigned short off_fat = (off_b % PER_SECSIZE)/4;/* 计算在FAT中的偏移（以FAT大小为单位） */
     fat += off_fat;
 
     /* 返回下一FAT */    
     return fat_n = Byte2Value((unsigned char *)fat,FAT_SIZE);
 }
 
+/* 获取文件下一簇簇号，FAT扇区缓存在调用者提供的fat_sec中 */
+/* 同一FAT扇区内连续查询时不重复读盘，cached_sec初始化为0即可 */
+static unsigned int YC_TakefileNextClu_Cached(unsigned int fl_clus,FAT32_Sec_t *fat_sec,unsigned int *cached_sec)
+{
+    unsigned int t_rSec = CLU_TO_FATSEC(fl_clus);
+    if(*cached_sec != t_rSec)
+    {
+        YC_FAT_DevRead((unsigned char *)fat_sec,t_rSec,1);
+        *cached_sec = t_rSec;
+    }
+    return Byte2Value((unsigned char *)&fat_sec->fat_sec[TAKE_FAT_OFF(fl_clus)],FAT_SIZE);
+}
+
 /* 解析根目录簇文件目录信息 */
 static SeekFile YC_FAT_ReadFileAttribute(FILE1 * file,unsigned char *filename)
 {
@@ -1038,7 +1422,7 @@ static SeekFile YC_FAT_ReadFileAttribute(FILE1 * file,unsigned char *filename)
     do{
         for(int i = 0;i < g_dbr[0].secPerClus;i++)
         {
-            usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
+            YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
 
             /* 从buffer进行文件名匹配 */
             FDI_t *fdi = NULL;
@@ -1072,7 +1456,8 @@ static SeekFile YC_FAT_ReadFileAttribute(FILE1 * file,unsigned char *filename)
 }
 
 /* 从第n簇（目录起始簇）解析目录簇链文件目录信息 */
-static SeekFile YC_FAT_MatchFile(unsigned int clu,FILE1 * file,unsigned char *filename)
+/* 匹配文件，fdi_out不为NULL时同时复制匹配到的目录项 */
+static SeekFile YC_FAT_MatchFDI(unsigned int clu,FILE1 * file,unsigned char *filename,FDI_t *fdi_out)
 {
     unsigned char DirToMatch[13]; /* 最后一字节为'\0' */
     unsigned int fdi_clu = clu;
@@ -1084,7 +1469,7 @@ static SeekFile YC_FAT_MatchFile(unsigned int clu,FILE1 * file,unsigned char *fi
     do{
         for(int i = 0;i < g_dbr[0].secPerClus;i++)
         {
-            usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
+            YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
 
             /* 从buffer进行文件名匹配 */
             FDI_t *fdi = NULL;
@@ -1109,6 +1494,7 @@ static SeekFile YC_FAT_MatchFile(unsigned int clu,FILE1 * file,unsigned char *fi
                             /* 保存文件FDI所在扇区及其在扇区内便宜啊至FILE1结构体，供写文件使用 */
                             file->fdi_info_t.fdi_sec = START_SECTOR_OF_FILE(fdi_clu)+i;
                             file->fdi_info_t.fdi_off = (unsigned int)fdi - (unsigned int)&fdis;
+                            if(NULL != fdi_out) *fdi_out = *fdi;
 
                             return FOUND;
                         }
@@ -1122,6 +1508,11 @@ static SeekFile YC_FAT_MatchFile(unsigned int clu,FILE1 * file,unsigned char *fi
     return NOTFOUND;
 }
 
+static SeekFile YC_FAT_MatchFile(unsigned int clu,FILE1 * file,unsigned char *filename)
+{
+    return YC_FAT_MatchFDI(clu,file,filename,NULL);
+}
+
 /**************************************************/
 /* 读取文件整条簇链（文件所有数据在所遍历的簇链中） */
 /* 传入参数：文件首簇，其他中间簇或尾簇未测试      */
@@ -1160,7 +1551,7 @@ static int TakeFileClusList_Eftv(unsigned int first_clu)
     unsigned int clu = first_clu;
 	unsigned int bk1;
     unsigned int *p = NULL;
-    unsigned char off_fat = ((clu * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;/* 计算在FAT中的偏移（以FAT大小为单位） */
+    unsigned short off_fat = ((clu * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;/* 计算在FAT中的偏移（以FAT大小为单位） */
 #if YC_FAT_DEBUG
     printf("文件首簇为%d\r\n",clu);
 #endif
@@ -1176,7 +1567,7 @@ static int TakeFileClusList_Eftv(unsigned int first_clu)
 #endif
         p = (unsigned int *)buffer0 + off_fat;
         /* 读出段簇所在扇区数据 */
-        usr_read(buffer0,CLU_TO_FATSEC(clu),1);
+        YC_FAT_DevRead(buffer0,CLU_TO_FATSEC(clu),1);
 		bk1 = clu;
 #if YC_FAT_DEBUG
 		printf("%d\r\n",clu);
@@ -1204,6 +1595,27 @@ static int TakeFileClusList_Eftv(unsigned int first_clu)
     return bk1;
 }
 
+/* 从簇clu沿簇链前进steps步，返回到达的簇，簇链提前结束时返回末簇 */
+static unsigned int YC_FAT_WalkClu(unsigned int clu,unsigned int steps)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int nxt;
+    while(steps--)
+    {
+        nxt = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if((nxt < 2) || (nxt >= 0x0ffffff8)) break;
+        clu = nxt;
+    }
+    return clu;
+}
+
+/* 按文件大小定位非空文件的尾簇，不以簇链末尾为准 */
+/* 预分配簇在关闭文件时才从簇链截掉，关闭前掉电时簇链比文件大小长 */
+static unsigned int YC_FAT_TailBySize(FILE1 *fl)
+{
+    return YC_FAT_WalkClu(fl->FirstClu,(fl->fl_sz-1)/(PER_SECSIZE*g_dbr[0].secPerClus));
+}
+
 /* 跨扇区，这个宏应该没什么用 */
 #define READ_EOS(f) (0 == (f->fl_sz-f->left_sz)%PER_SECSIZE)
 
@@ -1260,8 +1672,8 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
 	unsigned short powder_len;
     unsigned char off_sec;
     unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
-    unsigned int cur_leftsize = clu_size - fileInfo->EndCluSizeRead;
 #if YC_FAT_MULT_SEC_READ
+    unsigned int cur_leftsize = clu_size - fileInfo->EndCluSizeRead;
     if(t_rSize <= cur_leftsize)
     {
         off_sec = fileInfo->EndCluSizeRead/PER_SECSIZE;
@@ -1270,22 +1682,22 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
         {
             if(t_rSize <= powder_len)
             {
-                usr_read(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
+                YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
                 YC_MemCpy(buffer,buffer0+(PER_SECSIZE-powder_len),t_rSize);
             }
             else
             {
-                usr_read(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
+                YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
                 YC_MemCpy(buffer,buffer0+(PER_SECSIZE - powder_len),powder_len);
                 r_off += powder_len;
 				off_sec += 1;
                 int_secNum = once_secNum = (t_rSize-powder_len)/PER_SECSIZE;
                 if((t_rSize-powder_len)%PER_SECSIZE) once_secNum++;
-                usr_read(buffer+r_off,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
+                YC_FAT_DevRead(buffer+r_off,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
                 if(int_secNum != once_secNum){
                     r_off += int_secNum*PER_SECSIZE;
 					off_sec += int_secNum;
-                    usr_read(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
+                    YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
                     YC_MemCpy(buffer+r_off,buffer0,(t_rSize-powder_len)%PER_SECSIZE);
                 }
             }
@@ -1294,11 +1706,11 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
         {
             int_secNum = once_secNum = t_rSize/PER_SECSIZE;
             if(t_rSize%PER_SECSIZE) once_secNum++;
-            usr_read(buffer,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
+            YC_FAT_DevRead(buffer,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
             if(int_secNum != once_secNum)
             {
                 r_off += int_secNum*PER_SECSIZE;
-                usr_read(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec+int_secNum,1);
+                YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec+int_secNum,1);
                 YC_MemCpy(buffer+r_off,buffer0,t_rSize%PER_SECSIZE);
             }
         }
@@ -1319,12 +1731,12 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
         off_sec = fileInfo->EndCluSizeRead/PER_SECSIZE;
         if(int_secNum != once_secNum)
         {
-            usr_read(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
+            YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,1);
             YC_MemCpy(buffer,buffer0+PER_SECSIZE-powder_len,powder_len);
             r_off += powder_len;
 			off_sec ++;
         }
-        usr_read(buffer+r_off,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
+        YC_FAT_DevRead(buffer+r_off,START_SECTOR_OF_FILE(fileInfo->CurClus_R)+off_sec,int_secNum);
         r_off += cur_leftsize;
     }
 
@@ -1338,11 +1750,11 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
             fileInfo->CurClus_R = ((r_buffer_t *)pos)->r_e_clu;
 			int_secNum = once_secNum = (t_rSize - r_off)/PER_SECSIZE;
 			if((t_rSize - r_off)%PER_SECSIZE) once_secNum++;
-            usr_read(buffer+r_off,START_SECTOR_OF_FILE(chain_low),int_secNum);
+            YC_FAT_DevRead(buffer+r_off,START_SECTOR_OF_FILE(chain_low),int_secNum);
 			r_off = r_off + int_secNum * PER_SECSIZE;
 			powder_len = t_rSize - r_off;//最后不足一扇区的字节
 			if(powder_len){
-				usr_read(buffer0,START_SECTOR_OF_FILE(chain_low)+int_secNum,1);
+				YC_FAT_DevRead(buffer0,START_SECTOR_OF_FILE(chain_low)+int_secNum,1);
 			    YC_MemCpy(buffer+r_off,buffer0,powder_len);
             }
             break;/* 读簇缓冲链节点遍历完毕，跳出 */
@@ -1351,7 +1763,7 @@ static J_UINT32 YC_ReadDataNoCheck(FILE1* fileInfo,unsigned int off,unsigned int
         chain_low = ((r_buffer_t *)pos)->r_s_clu;
 		chain_high = ((r_buffer_t *)pos)->r_e_clu;
         once_secNum = (chain_high-chain_low+1)*g_dbr[0].secPerClus;
-        usr_read(buffer+r_off,START_SECTOR_OF_FILE(chain_low),once_secNum);
+        YC_FAT_DevRead(buffer+r_off,START_SECTOR_OF_FILE(chain_low),once_secNum);
         r_off += once_secNum * PER_SECSIZE;/* 更新偏移量 */
     }
     /* 释放读簇缓冲链 */
@@ -1363,7 +1775,7 @@ refresh_para_and_exit:
 #else
     /* 单扇区读 */
     char i;unsigned int l_ilegal = 0;  /* 已读的有效数据长度 */
-    static unsigned char app_buf[PER_SECSIZE];static unsigned int bk = 0;
+    static unsigned char app_buf[MAX_SECSIZE];static unsigned int bk = 0;
     unsigned int Secleft = 0,t_rb = t_rSize;/* 备份 */
     unsigned int n_clu = fileInfo->CurClus_R; /* 初始簇 */
     /* 计算需要读的扇区个数 */
@@ -1385,7 +1797,7 @@ refresh_para_and_exit:
             for(i = 0; i < Secleft; i ++)
             {
                 /* 取当前扇区数据 */
-				usr_read(app_buf,START_SECTOR_OF_FILE(n_clu)+fileInfo->CurOffSec , 1);
+				YC_FAT_DevRead(app_buf,START_SECTOR_OF_FILE(n_clu)+fileInfo->CurOffSec , 1);
                 memcpy((unsigned char *)buffer+l_ilegal,app_buf+fileInfo->CurOffByte,MIN(PER_SECSIZE-fileInfo->CurOffByte,t_rSize));
 				YC_Memset(buffer,0,PER_SECSIZE);
 				YC_StrCpy_l(buffer,app_buf+fileInfo->CurOffByte,MIN(PER_SECSIZE-fileInfo->CurOffByte,t_rSize));
@@ -1443,12 +1855,109 @@ refresh_para_and_exit:
 	return t_rSize;
 }
 
-/* 读文件 */
-unsigned int YC_FAT_Read(FILE1* fileInfo,unsigned char * d_buf,unsigned int len)
+#if YC_FAT_DIRECT_IO
+/* 当前簇已读字节数，簇边界处返回簇大小（读锚定仍停在上一簇） */
+static unsigned int YC_FAT_ReadCluOff(FILE1 *fl)
+{
+#if YC_FAT_MULT_SEC_READ
+    return fl->EndCluSizeRead;
+#else
+    return fl->CurOffSec*PER_SECSIZE + fl->CurOffByte;
+#endif
+}
+
+/* 按当前读偏移刷新读锚定 */
+static void YC_FAT_SetReadAnchor(FILE1 *fl,unsigned int clu)
+{
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int off = (fl->fl_sz-fl->left_sz)%clu_size;
+    if(0 == off) off = clu_size;
+    fl->CurClus_R = clu;
+#if YC_FAT_MULT_SEC_READ
+    fl->EndCluSizeRead = off;
+#else
+    fl->CurOffSec = off/PER_SECSIZE;
+    fl->CurOffByte = off%PER_SECSIZE;
+#endif
+}
+
+/* 直接I/O读，数据从设备直接读入用户缓冲区，物理连续的簇合并为一次多扇区读 */
+/* 当前读偏移和len都必须扇区对齐，文件末尾不足一扇区的部分也直接读入用户缓冲区 */
+static int YC_ReadDataDirect(FILE1* fileInfo,unsigned int len,unsigned char * buffer)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int t_rSize = MIN(len, fileInfo->left_sz);/* 需要读的数据大小 */
+    unsigned int sec2rd,off_sec,clu,next,n;
+    unsigned int run_sec,run_num,r_off = 0;
+    if(((fileInfo->fl_sz - fileInfo->left_sz)%PER_SECSIZE) || (len%PER_SECSIZE))
+        return DIRECT_IO_ALIGN_ERR;
+    if(!t_rSize) return 0;
+    sec2rd = t_rSize/PER_SECSIZE;
+    if(t_rSize%PER_SECSIZE) sec2rd++;
+    /* 锚定起始簇和簇内扇区偏移 */
+    clu = fileInfo->CurClus_R;
+    off_sec = YC_FAT_ReadCluOff(fileInfo)/PER_SECSIZE;
+    if(off_sec == g_dbr[0].secPerClus)
+    {
+        clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec);
+        off_sec = 0;
+    }
+    run_sec = START_SECTOR_OF_FILE(clu)+off_sec;
+    run_num = MIN(sec2rd, g_dbr[0].secPerClus-off_sec);
+    sec2rd -= run_num;
+    /* 合并物理连续簇，遇到不连续簇时提交前一段 */
+    while(sec2rd)
+    {
+        next = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec);
+        if(IS_EOF(next)) break;
+        n = MIN(sec2rd, g_dbr[0].secPerClus);
+        if(next != (clu + 1))
+        {
+            YC_FAT_VecRead(buffer+r_off,run_sec,run_num);
+            r_off += run_num*PER_SECSIZE;
+            run_sec = START_SECTOR_OF_FILE(next);
+            run_num = 0;
+        }
+        run_num += n;sec2rd -= n;
+        clu = next;
+    }
+    YC_FAT_VecRead(buffer+r_off,run_sec,run_num);
+    YC_FAT_VecSubmit();/* 所有段一次提交 */
+    /* 刷新读锚定 */
+    fileInfo->left_sz -= t_rSize;
+    YC_FAT_SetReadAnchor(fileInfo,clu);
+    return t_rSize;
+}
+#endif
+
+#if YC_FAT_DELALLOC
+/* 函数声明 */
+static int YC_FAT_DelallocFlush(FILE1 *fl);
+static int YC_FAT_DelallocWrite(FILE1 *fl,unsigned char *d_buf,unsigned int len);
+static int YC_FAT_DelallocClose(FILE1 *fl);
+#endif
+#if YC_FAT_ASYNC_IO
+static unsigned char YC_FAT_AioBusy(FILE1 *fl);
+#endif
+
+/* 读文件，返回读到的字节数，负数为错误码 */
+int YC_FAT_Read(FILE1* fileInfo,unsigned char * d_buf,unsigned int len)
 {
-    unsigned int ret;unsigned int off;
+    int ret;unsigned int off;
+#if YC_FAT_DELALLOC
+    /* 暂存的数据先写入，读到的是完整文件 */
+    if((FILE_OPEN == fileInfo->file_state) && fileInfo->da_len)
+    {
+        YC_FAT_DelallocFlush(fileInfo);
+        YC_FAT_Commit();
+    }
+#endif
     if((FILE_OPEN != fileInfo->file_state) || (!fileInfo->fl_sz)) 
         return -1;
+#if YC_FAT_DIRECT_IO
+    if(fileInfo->oflag & YC_O_DIRECT)
+        return YC_ReadDataDirect(fileInfo,len,d_buf);/* 不对齐时返回错误码，不做中转拷贝 */
+#endif
     if(1){
         off = fileInfo->fl_sz - fileInfo->left_sz;
 	    ret = YC_ReadDataNoCheck(fileInfo,off,len,d_buf);//追加数据
@@ -1616,167 +2125,714 @@ static char YC_FAT_TakeFP(unsigned char * s,unsigned char *d)
     return 1;
 }
 
-#if FILE_CACHE
-/* 从缓冲区匹配文件 */
-static int MatchFromCache(FILE1 * ftc)
+#if YC_FAT_DEFRAG
+/* 文件修改记录，碎片整理单步之间据此发现文件被覆盖写、回写或簇链改变 */
+/* 每次修改递增修改代号，连续修改同一文件只更新最近一条记录 */
+static struct {
+    unsigned int fdi_sec;
+    unsigned short fdi_off;
+    unsigned int gen;
+}mod_log[DEFRAG_MOD_LOG];
+static unsigned char mod_head = 0,mod_n = 0;
+static unsigned int mod_gen = 0;   /* 当前修改代号 */
+static unsigned int mod_lost = 0;  /* 被挤出记录表的最新修改代号 */
+
+/* 记录文件被修改 */
+static void YC_FAT_NoteModify(FILE1 * fl)
 {
-	int i;
-    for (i = 0; i < MAX_FILES_CACHE; i++){
-        if((file_cache[i].fdi_info_c_t.fdi_sec_c == ftc->fdi_info_t.fdi_sec)&&
-        (file_cache[i].fdi_info_c_t.fdi_off_c == ftc->fdi_info_t.fdi_off))
+    unsigned char i;
+    mod_gen++;
+    if(mod_n)
+    {
+        i = (mod_head+DEFRAG_MOD_LOG-1)%DEFRAG_MOD_LOG;
+        if((mod_log[i].fdi_sec == fl->fdi_info_t.fdi_sec) && (mod_log[i].fdi_off == fl->fdi_info_t.fdi_off))
         {
-            return i;
+            mod_log[i].gen = mod_gen;
+            return;
         }
     }
-    return -1;
+    if(DEFRAG_MOD_LOG == mod_n) mod_lost = mod_log[mod_head].gen;/* 挤出最早的一条 */
+    else mod_n++;
+    mod_log[mod_head].fdi_sec = fl->fdi_info_t.fdi_sec;
+    mod_log[mod_head].fdi_off = fl->fdi_info_t.fdi_off;
+    mod_log[mod_head].gen = mod_gen;
+    mod_head = (mod_head+1)%DEFRAG_MOD_LOG;
 }
-/* 更新文件缓冲区 */
-static void update_cache(int ind, FILE1 * ftc)
+
+/* 文件在代号gen之后是否可能被修改过，记录已被挤出时保守地返回1 */
+static unsigned char YC_FAT_ModifiedSince(unsigned int sec,unsigned short off,unsigned int gen)
 {
-    int i,j;FileCacheEntry tmp_cache;
-    if(ind < 0) 
-	{/* 缓冲区匹配不到该文件 */
-		for(i = 0; i < MAX_FILES_CACHE; i++)
-		{
-			if (file_cache[i].fdi_info_c_t.fdi_sec_c == 0)
-			{ /* 找到第一个空位 */
-				for(j = i; j > 0; j--){
-					file_cache[j] = file_cache[j-1];
-				}
-				file_cache[0].tail_cluster = ftc->EndClu;
-				file_cache[0].fdi_info_c_t.fdi_off_c = ftc->fdi_info_t.fdi_off;
-				file_cache[0].fdi_info_c_t.fdi_sec_c = ftc->fdi_info_t.fdi_sec;
-				return;
-			}
-		}
-		/* 找不到空位插到头部，其余缓冲区循环后移 */
-		for(j = MAX_FILES_CACHE-1; j > 0; j--){
-			file_cache[j] = file_cache[j-1];
-		}
-		file_cache[0].tail_cluster = ftc->EndClu;
-		file_cache[0].fdi_info_c_t.fdi_off_c = ftc->fdi_info_t.fdi_off;
-		file_cache[0].fdi_info_c_t.fdi_sec_c = ftc->fdi_info_t.fdi_sec;
-		return;
-    }else{/* 缓冲区可以匹配到该文件 */
-        for(j = ind; j > 0; j--){
-			file_cache[j] = file_cache[j-1];
-        }
-        file_cache[0] = tmp_cache;
-		file_cache[0].fdi_info_c_t.fdi_off_c = ftc->fdi_info_t.fdi_off;
-		file_cache[0].fdi_info_c_t.fdi_sec_c = ftc->fdi_info_t.fdi_sec;
-		file_cache[0].tail_cluster = ftc->EndClu;
-    }
+    unsigned char i;
+    if(mod_lost > gen) return 1;
+    for(i = 0;i < mod_n;i++)
+        if((mod_log[i].gen > gen) && (mod_log[i].fdi_sec == sec) && (mod_log[i].fdi_off == off))
+            return 1;
+    return 0;
 }
 #endif
+
 #if MAX_OPEN_FILES
-static char update_matchInfo(FILE1 * fto,char add_or_del,char del_mode)
+/* 查找文件在打开文件表中的表项，未打开返回NULL */
+static Match_Info_t *YC_FAT_OpenTabFind(unsigned int sec,unsigned short off)
 {
-	int i;
-	if(add_or_del == 1){
-		for(i = 0; i < MAX_OPEN_FILES; i++){
-			if((matchInfo[i].ffdi_off == 0)&&(matchInfo[i].ffdi_sec == 0)) {
-				matchInfo[i].ffdi_off = fto->fdi_info_t.fdi_off;matchInfo[i].ffdi_sec = fto->fdi_info_t.fdi_sec;
-				matchInfo[i].is_open = 1;
-				return 0;
-			}
-		}
-	}else if(add_or_del == 2){
-		if(del_mode == 1){
-			for(i = 0; i < MAX_OPEN_FILES; i++){
-				if((matchInfo[i].ffdi_off == fto->fdi_info_t.fdi_off)&&(matchInfo[i].ffdi_sec == fto->fdi_info_t.fdi_sec)) {
-					matchInfo[i].ffdi_off = matchInfo[i].ffdi_sec = 0;
-					matchInfo[i].is_open = 0;
-					return 0;
-				}
-			}
-		}else if(del_mode == 2){
-			for(i = 0; i < MAX_OPEN_FILES; i++){
-				if((matchInfo[i].ffdi_off == fto->fdi_info_t.fdi_off)&&(matchInfo[i].ffdi_sec == fto->fdi_info_t.fdi_sec)) return 1;
-			}
-		}
-	}
-	return 0;
+    unsigned short i = open_hash[OPEN_HASH(sec,off)];
+    for(;i;i = matchInfo[i-1].next)
+        if((matchInfo[i-1].ffdi_sec == sec) && (matchInfo[i-1].ffdi_off == off))
+            return &matchInfo[i-1];
+    return NULL;
 }
-#endif
-/* 函数声明 */
-static int YC_FAT_EnterDir(unsigned char *dir);
-/* 打开文件（雏形） */
-FILE1 * YC_FAT_OpenFile(FILE1 * f_op, unsigned char * filepath)
+
+/* 文件是否已被打开 */
+static unsigned char YC_FAT_FileIsOpen(FILE1 * fto)
 {
-    if(!open_sem) return NULL;
-    FILE1 * file = NULL;
-    unsigned char fp[50];
-    unsigned int file_clu = 0;
-    int j = -1;
-    if(f_op->file_state == FILE_OPEN)
-        return NULL;
-	unsigned char len1,len2;
-    /* 文件路径预处理 */
-    DelexcSpace(filepath,fp);
-	len1 =  YC_StrLen(fp);
-    /* 从路径匹配文件名 */
-    unsigned char f_n[50] = {0};
-    if(!YC_FAT_TakeFN(fp,f_n)) return NULL;
-	len2 =  YC_StrLen(f_n);
-    /* 从路径匹配目录名 */
-    unsigned char f_p[50] = {0};
-	if(len1-len2)
-		YC_StrCpy_l(f_p,fp,len1-len2);
-	
-    if(!IS_FILENAME_ILLEGAL(f_n))
-        return NULL;
-    /* 进入文件目录，这里假设是标准绝对路径寻找文件 */
-    file_clu = YC_FAT_EnterDir(f_p);
+    return (NULL != YC_FAT_OpenTabFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off)) ? 1 : 0;
+}
 
-    if(FOUND == YC_FAT_MatchFile(file_clu,f_op,f_n))
+/* 登记打开的句柄，已打开的文件引用数加1，表满返回-1 */
+static int YC_FAT_OpenTabAdd(FILE1 * fto)
+{
+    unsigned int sec = fto->fdi_info_t.fdi_sec;
+    unsigned short off = fto->fdi_info_t.fdi_off,h,i;
+    Match_Info_t *m = YC_FAT_OpenTabFind(sec,off);
+    if(NULL != m)
     {
-        /* 匹配成功 */
-        file = f_op; 
-		/* 找出文件尾簇,写文件用 */
-		if(file->fl_sz == 0){
-			file->EndClu = 0;
-			file->EndCluLeftSize = 0;
-		}
-		else{
-#if FILE_CACHE
-            j = MatchFromCache(f_op);
-            if(j < 0) {
-                file->EndClu = TakeFileClusList_Eftv(file->FirstClu);
-            }
-            else {
-                file->EndClu = TakeFileClusList_Eftv(file_cache[j].tail_cluster);
-            }
-            /* 更新文件缓冲区 */
-            update_cache(j,f_op);
-#else
-            file->EndClu = TakeFileClusList_Eftv(file->FirstClu);
-#endif
-			/* 计算尾簇剩余可用空间 */
-			file->EndCluLeftSize = PER_SECSIZE*g_dbr[0].secPerClus-(file->fl_sz)%(PER_SECSIZE*g_dbr[0].secPerClus);
-			if(file->EndCluLeftSize == PER_SECSIZE*g_dbr[0].secPerClus)/* 临界处理 */
-				file->EndCluLeftSize = 0;
-        }
-		file->EndCluSizeRead = 0;
-        file->CurClus_R = file->FirstClu;//读索引（以簇为单位）
-		INIT_LIST_HEAD(&file->RDCluChainList);
-		INIT_LIST_HEAD(&file->WRCluChainList);
-        file->file_state = FILE_OPEN; open_sem--;update_matchInfo(f_op,1,1);
-        return file;
+        m->ref++;
+        return 0;
     }
-#if YC_FAT_DEBUG
-	else{
-		printf("需要打开的文件不存在\r\n");
+    if(open_free)
+    {
+        i = open_free;
+        open_free = matchInfo[i-1].next;
+    }
+    else if(open_used < MAX_OPEN_FILES)
+        i = ++open_used;
+    else
+        return -1;
+    m = &matchInfo[i-1];
+    m->ffdi_sec = sec;m->ffdi_off = off;m->ref = 1;
+#if OPEN_EXTENTS
+    m->ext_n = 0;
+#endif
+    h = OPEN_HASH(sec,off);
+    m->next = open_hash[h];
+    open_hash[h] = i;
+    return 0;
+}
+
+/* 注销句柄，引用数减到0时从散列链摘除并放回空闲链 */
+static void YC_FAT_OpenTabDel(FILE1 * fto)
+{
+    unsigned int sec = fto->fdi_info_t.fdi_sec;
+    unsigned short off = fto->fdi_info_t.fdi_off;
+    unsigned short *pi = &open_hash[OPEN_HASH(sec,off)],i;
+    for(;(i = *pi);pi = &matchInfo[i-1].next)
+    {
+        if((matchInfo[i-1].ffdi_sec != sec) || (matchInfo[i-1].ffdi_off != off)) continue;
+        if(--matchInfo[i-1].ref) return;
+        *pi = matchInfo[i-1].next;
+        matchInfo[i-1].next = open_free;
+        open_free = i;
+        return;
+    }
+}
+
+#if OPEN_EXTENTS
+/* 簇链改变（追加、预分配、裁剪）后作废共享区段表，下次使用时重建 */
+static void YC_FAT_ExtentsInvalidate(FILE1 * fto)
+{
+    Match_Info_t *m = YC_FAT_OpenTabFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+    if(NULL != m) m->ext_n = 0;
+}
+
+/* 由共享区段表换算文件第idx个簇，区段表不可用或idx超出簇链时返回0 */
+/* 区段表在第一次使用时遍历簇链建立，段数超过OPEN_EXTENTS时不建立，调用者回退到遍历FAT */
+static unsigned int YC_FAT_ExtentClu(FILE1 * fto,unsigned int idx)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu,nxt,end = CLU_END();
+    unsigned short k;
+    Match_Info_t *m = YC_FAT_OpenTabFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+    if((NULL == m) || (OPEN_EXT_NONE == m->ext_n) || (fto->FirstClu < 2)) return 0;
+    if(!m->ext_n)
+    {
+        clu = fto->FirstClu;
+        m->ext[0].clu = clu;m->ext[0].num = 1;k = 1;
+        for(;;)
+        {
+            nxt = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+            if((nxt < 2) || (nxt >= end)) break;
+            if(nxt == clu+1) m->ext[k-1].num++;
+            else if(k == OPEN_EXTENTS)
+            {
+                m->ext_n = OPEN_EXT_NONE;
+                return 0;
+            }
+            else
+            {
+                m->ext[k].clu = nxt;m->ext[k].num = 1;k++;
+            }
+            clu = nxt;
+        }
+        m->ext_n = k;
+    }
+    for(k = 0;k < m->ext_n;k++)
+    {
+        if(idx < m->ext[k].num) return m->ext[k].clu+idx;
+        idx -= m->ext[k].num;
+    }
+    return 0;
+}
+#endif
+#endif
+#if FILE_CACHE
+/* 查找文件缓存表项，未缓存返回NULL */
+static FileCacheEntry *YC_FAT_CacheFind(unsigned int sec,unsigned short off)
+{
+    unsigned short i = fcache.hash[FCACHE_HASH(sec,off)];
+    for(;i;i = fcache.ent[i-1].hnext)
+        if((fcache.ent[i-1].fdi_sec == sec) && (fcache.ent[i-1].fdi_off == off))
+            return &fcache.ent[i-1];
+    return NULL;
+}
+
+/* 从LRU链摘除表项 */
+static void YC_FAT_CacheUnlink(FileCacheEntry *e)
+{
+    if(e->prev) fcache.ent[e->prev-1].next = e->next;
+    else fcache.head = e->next;
+    if(e->next) fcache.ent[e->next-1].prev = e->prev;
+    else fcache.tail = e->prev;
+}
+
+/* 表项移到LRU链头 */
+static void YC_FAT_CacheTouch(FileCacheEntry *e)
+{
+    unsigned short i = e-fcache.ent+1;
+    if(fcache.head == i) return;
+    YC_FAT_CacheUnlink(e);
+    e->prev = 0;
+    e->next = fcache.head;
+    if(fcache.head) fcache.ent[fcache.head-1].prev = i;
+    else fcache.tail = i;
+    fcache.head = i;
+}
+
+/* 删除表项，表项留在LRU链尾等待复用 */
+static void YC_FAT_CacheDrop(unsigned int sec,unsigned short off)
+{
+    unsigned short *pi = &fcache.hash[FCACHE_HASH(sec,off)],i;
+    FileCacheEntry *e;
+    for(;(i = *pi);pi = &fcache.ent[i-1].hnext)
+    {
+        e = &fcache.ent[i-1];
+        if((e->fdi_sec != sec) || (e->fdi_off != off)) continue;
+        *pi = e->hnext;
+        e->fdi_sec = 0;
+        YC_FAT_CacheUnlink(e);
+        e->prev = fcache.tail;e->next = 0;
+        if(fcache.tail) fcache.ent[fcache.tail-1].next = i;
+        else fcache.head = i;
+        fcache.tail = i;
+        return;
+    }
+}
+
+/* 写入文件的首簇、尾簇和大小，未缓存时占用空闲表项或淘汰最久未用的表项 */
+/* 簇链信息改变时作废区段表 */
+static FileCacheEntry *YC_FAT_CachePut(unsigned int sec,unsigned short off,unsigned int first,unsigned int tail,unsigned int sz)
+{
+    FileCacheEntry *e = YC_FAT_CacheFind(sec,off);
+    unsigned short i,h;
+    if(NULL == e)
+    {
+        if(fcache.used < MAX_FILES_CACHE)
+        {
+            i = ++fcache.used;
+            e = &fcache.ent[i-1];
+            e->prev = 0;
+            e->next = fcache.head;
+            if(fcache.head) fcache.ent[fcache.head-1].prev = i;
+            else fcache.tail = i;
+            fcache.head = i;
+        }
+        else
+        {
+            e = &fcache.ent[fcache.tail-1];
+            if(e->fdi_sec) YC_FAT_CacheDrop(e->fdi_sec,e->fdi_off);
+        }
+        e->fdi_sec = sec;e->fdi_off = off;
+        h = FCACHE_HASH(sec,off);
+        e->hnext = fcache.hash[h];
+        fcache.hash[h] = e-fcache.ent+1;
+        e->first_clu = ~first;/* 强制下面更新 */
+    }
+    if((e->first_clu != first) || (e->tail_clu != tail) || (e->fl_sz != sz))
+    {
+        e->first_clu = first;e->tail_clu = tail;e->fl_sz = sz;
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+        e->ext_n = 0;
+#endif
+    }
+    YC_FAT_CacheTouch(e);
+    return e;
+}
+
+/* 清空文件缓存，挂载时调用 */
+static void YC_FAT_CacheReset(void)
+{
+    YC_Memset((unsigned char *)&fcache,0,sizeof(fcache));
+    fcache.magic = FCACHE_MAGIC;
+    fcache.vol_id = g_dbr[0].vollD;
+    fcache.fat1sec = FatInitArgs_a[0].FAT1Sec;
+}
+
+/* 取文件尾簇，大小未变时使用缓存的尾簇，文件变大时只从缓存的尾簇向后前进新增的簇数 */
+/* 首簇改变或文件变小时从首簇按文件大小定位 */
+/* 缓存可能是上次挂载时保存的，期间簇链可能被其他系统改写，缓存的尾簇须仍是簇链末尾（读一个FAT扇区） */
+static unsigned int YC_FAT_CacheTail(FILE1 * ftc)
+{
+    FileCacheEntry *e = YC_FAT_CacheFind(ftc->fdi_info_t.fdi_sec,ftc->fdi_info_t.fdi_off);
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int tail;
+    if((NULL != e) && (e->first_clu == ftc->FirstClu) && e->fl_sz && (e->fl_sz <= ftc->fl_sz) && (e->tail_clu >= 2))
+    {
+        if(e->fl_sz != ftc->fl_sz)
+            tail = YC_FAT_WalkClu(e->tail_clu,(ftc->fl_sz-1)/clu_size-(e->fl_sz-1)/clu_size);
+        else if((YC_TakefileNextClu(e->tail_clu) & 0x0fffffff) >= 0x0ffffff8)
+        {
+            YC_FAT_CacheTouch(e);
+            return e->tail_clu;
+        }
+        else
+            tail = YC_FAT_TailBySize(ftc);
+    }
+    else
+        tail = YC_FAT_TailBySize(ftc);
+    YC_FAT_CachePut(ftc->fdi_info_t.fdi_sec,ftc->fdi_info_t.fdi_off,ftc->FirstClu,tail,ftc->fl_sz);
+    return tail;
+}
+
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+/* 打开文件时用缓存的区段表初始化打开文件表，随机访问不再遍历FAT建立区段表 */
+static void YC_FAT_CacheLoadExtents(FILE1 * fto)
+{
+    FileCacheEntry *e = YC_FAT_CacheFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+    Match_Info_t *m = YC_FAT_OpenTabFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+    if((NULL == e) || (NULL == m) || m->ext_n || !e->ext_n) return;
+    if((e->first_clu != fto->FirstClu) || (e->fl_sz != fto->fl_sz)) return;
+    YC_ConstMem_l((unsigned char *)m->ext,(unsigned char *)e->ext,sizeof(m->ext));
+    m->ext_n = e->ext_n;
+}
+#endif
+
+/* 关闭文件时记录最终的尾簇和大小，打开文件表中已建立的区段表一并保存 */
+static void YC_FAT_CacheClose(FILE1 * fto)
+{
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    FileCacheEntry *e;
+    Match_Info_t *m;
+#endif
+    if(!fto->fl_sz || (fto->FirstClu < 2) || (fto->EndClu < 2))
+    {
+        YC_FAT_CacheDrop(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+        return;
+    }
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    e = YC_FAT_CachePut(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off,fto->FirstClu,fto->EndClu,fto->fl_sz);
+    m = YC_FAT_OpenTabFind(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off);
+    if((NULL != m) && m->ext_n && !e->ext_n)
+    {
+        YC_ConstMem_l((unsigned char *)e->ext,(unsigned char *)m->ext,sizeof(e->ext));
+        e->ext_n = m->ext_n;
+    }
+#else
+    YC_FAT_CachePut(fto->fdi_info_t.fdi_sec,fto->fdi_info_t.fdi_off,fto->FirstClu,fto->EndClu,fto->fl_sz);
+#endif
+}
+
+#if FCACHE_PERSIST
+/* 卸载时通过ioopr_t.CacheSave保存文件缓存 */
+static void YC_FAT_CacheSave(ioopr_t *io)
+{
+    if(NULL != io->CacheSave)
+        io->CacheSave((void *)&fcache,sizeof(fcache));
+}
+
+/* 挂载时通过ioopr_t.CacheLoad恢复文件缓存，上次未正常卸载或不是同一个卷时丢弃 */
+static void YC_FAT_CacheLoad(ioopr_t *io,unsigned char clean)
+{
+    if(!clean || (NULL == io->CacheLoad)) return;
+    if((0 != io->CacheLoad((void *)&fcache,sizeof(fcache))) || (FCACHE_MAGIC != fcache.magic) || \
+        (fcache.vol_id != g_dbr[0].vollD) || (fcache.fat1sec != FatInitArgs_a[0].FAT1Sec) || (fcache.used > MAX_FILES_CACHE))
+        YC_FAT_CacheReset();
+}
+#endif
+#endif
+#if YC_FILE2MEM
+/* 文件内存映像错误码 */
+#define FILE2MEM_PARAM_ERR -1
+#define FILE2MEM_SIZE_ERR -2    /* 内存区小于文件按扇区取整后的大小 */
+#define FILE2MEM_HEAP_ERR -3    /* 堆空间不足 */
+
+/* 文件按扇区取整后的扇区数 */
+#define FILE_SECS(fl) (((fl)->fl_sz+PER_SECSIZE-1)/PER_SECSIZE)
+
+/* 释放文件内存映像，堆中分配的映像归还堆 */
+static void YC_FAT_MemRelease(FILE1 *fl)
+{
+    if(fl->mem_own) tFreeHeapforeach((void *)fl->mem);
+    tFreeHeapforeach((void *)fl->mem_dirty);
+    fl->mem = fl->mem_dirty = NULL;
+    fl->mem_own = 0;
+    fl->mem_secs = 0;
+}
+
+/* 将整个文件读入内存，之后可直接按内存访问文件，不再读设备 */
+/* mem_base为NULL时从堆中分配，否则mem_sz为调用者内存区大小，不能小于文件按扇区取整后的大小 */
+/* 按簇链顺序读取，物理连续的簇在段表中合并为一次多扇区读 */
+static int YC_FAT_Load2Memory(FILE1 *fl,void *mem_base,int mem_sz)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int nsec,done,n,clu;
+    if((NULL == fl) || (FILE_OPEN != fl->file_state) || (NULL != fl->mem))
+        return FILE2MEM_PARAM_ERR;
+#if YC_FAT_DELALLOC
+    if(fl->da_len)
+    {
+        YC_FAT_DelallocFlush(fl);
+        YC_FAT_Commit();
+    }
+#endif
+    if(!fl->fl_sz) return FILE2MEM_PARAM_ERR;
+    nsec = FILE_SECS(fl);
+    if(NULL == mem_base)
+    {
+        mem_base = tAllocHeapforeach(nsec*PER_SECSIZE);
+        if(NULL == mem_base) return FILE2MEM_HEAP_ERR;
+        fl->mem_own = 1;
+    }
+    else if((mem_sz < 0) || ((unsigned int)mem_sz < nsec*PER_SECSIZE))
+        return FILE2MEM_SIZE_ERR;
+    else
+        fl->mem_own = 0;
+    fl->mem = (unsigned char *)mem_base;
+    fl->mem_secs = nsec;
+    /* 脏扇区位图，每扇区1位 */
+    fl->mem_dirty = (unsigned char *)tAllocHeapforeach((nsec+7)/8);
+    if(NULL == fl->mem_dirty)
+    {
+        YC_FAT_MemRelease(fl);
+        return FILE2MEM_HEAP_ERR;
+    }
+    YC_Memset(fl->mem_dirty,0,(nsec+7)/8);
+    for(clu = fl->FirstClu,done = 0;done < nsec;done += n)
+    {
+        if(done) clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        n = MIN(nsec-done,(unsigned int)g_dbr[0].secPerClus);
+        YC_FAT_VecRead(fl->mem+done*PER_SECSIZE,START_SECTOR_OF_FILE(clu),n);
+    }
+    YC_FAT_VecSubmit();
+    return 0;
+}
+
+/* 标记内存映像中[off,off+len)已被修改，回写时只写入这些扇区 */
+int YC_FAT_MemDirty(FILE1 *fl,unsigned int off,unsigned int len)
+{
+    unsigned int s,e,lim;
+    if((NULL == fl) || (NULL == fl->mem) || !len)
+        return FILE2MEM_PARAM_ERR;
+    lim = MIN(fl->fl_sz,fl->mem_secs*PER_SECSIZE);/* 不超出映像 */
+    if(off >= lim) return FILE2MEM_PARAM_ERR;
+    if(len > lim-off) len = lim-off;
+    e = (off+len-1)/PER_SECSIZE;
+    for(s = off/PER_SECSIZE;s <= e;s++)
+        fl->mem_dirty[s>>3] |= 1<<(s&7);
+    return 0;
+}
+
+/* 回写内存映像中的脏扇区，release非0时回写后释放映像 */
+/* 相邻的脏扇区在段表中合并为一次多扇区写，文件大小不变 */
+static int YC_FAT_Writeback(FILE1 *fl,void *mem_base,int release)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int nsec,s,k,clu;
+    if((NULL == fl) || (NULL == fl->mem)) return FILE2MEM_PARAM_ERR;
+    if((NULL != mem_base) && ((unsigned char *)mem_base != fl->mem)) return FILE2MEM_PARAM_ERR;
+    nsec = fl->mem_secs;
+    clu = fl->FirstClu;
+    for(s = 0;s < nsec;s++)
+    {
+        k = s%g_dbr[0].secPerClus;
+        if(s && !k) clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if(fl->mem_dirty[s>>3] & (1<<(s&7)))
+            YC_FAT_VecWrite(fl->mem+s*PER_SECSIZE,START_SECTOR_OF_FILE(clu)+k,1);
+    }
+    YC_FAT_VecSubmit();
+#if YC_FAT_DEFRAG
+    YC_FAT_NoteModify(fl);
+#endif
+    YC_Memset(fl->mem_dirty,0,(nsec+7)/8);
+    if(release) YC_FAT_MemRelease(fl);
+    return 0;
+}
+#endif
+/* 函数声明 */
+static int YC_FAT_EnterDir(unsigned char *dir);
+#if YC_FAT_RING
+int YC_FAT_Del_File(unsigned char *file_path);
+#endif
+#if YC_FAT_DEFER_FREE
+int YC_FAT_Idle(void);
+#endif
+#if YC_FAT_PREALLOC
+static void YC_FAT_TrimPrealloc(FILE1 *fl);
+static int YC_FAT_PreallocClus(FILE1 *fl,unsigned int need,unsigned char anywhere);
+
+/* 接管文件尾簇之后多出的簇链作为预分配簇，追加写时先取用，关闭时释放 */
+/* 上次关闭前掉电时预分配簇还链接在尾簇之后；簇链没有以结束标记正常结束时不接管，留给磁盘检查 */
+/* 空文件有首簇时整条簇链都是预分配簇，与打开期间预分配后的状态相同，首次写入不再改写目录项首簇 */
+static void YC_FAT_AdoptOverhang(FILE1 *fl)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int first,clu,nxt,n = 0,end = CLU_END();
+    if(fl->fl_sz)
+    {
+        if(fl->EndClu < 2) return;
+        first = clu = YC_TakefileNextClu_Cached(fl->EndClu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if(clu >= 0x0ffffff8) return;/* 尾簇就是簇链末尾 */
+    }
+    else if(0 == (first = clu = fl->FirstClu)) return;
+    for(;;)
+    {
+        if((clu < 2) || (clu >= end) || (n >= end)) return;/* 非法簇号或簇链成环 */
+        n++;
+        nxt = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if(nxt >= 0x0ffffff8) break;
+        clu = nxt;
+    }
+    fl->PreClu = first;
+    fl->PreEnd = clu;
+    fl->PreNum = n;
+}
+#endif
+/* 打开文件收尾：由已确定的尾簇计算尾簇剩余空间，初始化读写状态并登记到打开文件表 */
+static FILE1 * YC_FAT_OpenSetup(FILE1 * file)
+{
+    if(file->fl_sz == 0){
+        file->EndClu = 0;
+        file->EndCluLeftSize = 0;
+    }
+    else{
+        /* 计算尾簇剩余可用空间 */
+        file->EndCluLeftSize = PER_SECSIZE*g_dbr[0].secPerClus-(file->fl_sz)%(PER_SECSIZE*g_dbr[0].secPerClus);
+        if(file->EndCluLeftSize == PER_SECSIZE*g_dbr[0].secPerClus)/* 临界处理 */
+            file->EndCluLeftSize = 0;
+    }
+#if !YC_FAT_MULT_SEC_READ
+    file->CurOffSec = 0;
+    file->CurOffByte = 0;
+#else
+    file->EndCluSizeRead = 0;
+#endif
+    file->CurClus_R = file->FirstClu;//读索引（以簇为单位）
+    INIT_LIST_HEAD(&file->RDCluChainList);
+    INIT_LIST_HEAD(&file->WRCluChainList);
+    /* 登记到打开文件表，表满时打开失败 */
+    if(0 != YC_FAT_OpenTabAdd(file)) return NULL;
+#if FILE_CACHE && MAX_OPEN_FILES && OPEN_EXTENTS
+    YC_FAT_CacheLoadExtents(file);
+#endif
+    file->file_state = FILE_OPEN;
+#if YC_FAT_PREALLOC
+    file->PreClu = file->PreEnd = file->PreNum = file->PreTaken = 0;
+    /* 只由第一个打开的句柄接管，其他句柄已打开时多出的簇是它的预分配簇 */
+    if(1 == YC_FAT_OpenTabFind(file->fdi_info_t.fdi_sec,file->fdi_info_t.fdi_off)->ref)
+        YC_FAT_AdoptOverhang(file);
+#endif
+#if YC_FAT_DELALLOC
+    file->da_buf = NULL;
+    file->da_sz = file->da_len = 0;
+    file->da_own = 0;
+#endif
+#if YC_FILE2MEM
+    file->load2memory = YC_FAT_Load2Memory;
+    file->Writeback = YC_FAT_Writeback;
+    file->mem = file->mem_dirty = NULL;
+    file->mem_own = 0;
+    file->mem_secs = 0;
+#endif
+#if YC_FAT_DIRECT_IO
+    file->oflag = YC_O_NORMAL;
+#endif
+    return file;
+}
+
+/* 打开文件（雏形） */
+FILE1 * YC_FAT_OpenFile(FILE1 * f_op, unsigned char * filepath)
+{
+    FILE1 * file = NULL;
+    unsigned char fp[50];
+    unsigned int file_clu = 0;
+    if(f_op->file_state == FILE_OPEN)
+        return NULL;
+	unsigned char len1,len2;
+    /* 文件路径预处理 */
+    DelexcSpace(filepath,fp);
+	len1 =  YC_StrLen(fp);
+    /* 从路径匹配文件名 */
+    unsigned char f_n[50] = {0};
+    if(!YC_FAT_TakeFN(fp,f_n)) return NULL;
+	len2 =  YC_StrLen(f_n);
+    /* 从路径匹配目录名 */
+    unsigned char f_p[50] = {0};
+	if(len1-len2)
+		YC_StrCpy_l(f_p,fp,len1-len2);
+	
+    if(!IS_FILENAME_ILLEGAL(f_n))
+        return NULL;
+    /* 进入文件目录，这里假设是标准绝对路径寻找文件 */
+    file_clu = YC_FAT_EnterDir(f_p);
+    if((int)file_clu < 0) return NULL;
+
+    if(FOUND == YC_FAT_MatchFile(file_clu,f_op,f_n))
+    {
+        /* 匹配成功 */
+        file = f_op; 
+		/* 找出文件尾簇,写文件用 */
+		if(file->fl_sz == 0){
+			file->EndClu = 0;
+			file->EndCluLeftSize = 0;
+		}
+		else{
+#if FILE_CACHE
+            /* 大小未变时直接取缓存的尾簇，不遍历簇链 */
+            file->EndClu = YC_FAT_CacheTail(file);
+#else
+            file->EndClu = YC_FAT_TailBySize(file);
+#endif
+        }
+        return YC_FAT_OpenSetup(file);
+    }
+#if YC_FAT_DEBUG
+	else{
+		printf("需要打开的文件不存在\r\n");
 	}
 #endif
     return NULL;
 }
 
+#if YC_FAT_DIRECT_IO
+/* 按指定标志打开文件，oflag为YC_O_DIRECT时读写走直接I/O */
+FILE1 * YC_FAT_OpenFileEx(FILE1 * f_op, unsigned char * filepath, unsigned char oflag)
+{
+    FILE1 * file = YC_FAT_OpenFile(f_op,filepath);
+    if(NULL != file)
+        file->oflag = oflag;
+    return file;
+}
+#endif
+
+#if YC_FAT_FTOKEN
+/* 文件令牌，记录目录项位置、首簇、尾簇和文件大小，重新打开时跳过路径解析、目录查找和簇链遍历 */
+/* 同时记录8.3文件名和创建时间，同一位置删除后重建的文件即使首簇相同也不会被误认 */
+typedef struct {
+    unsigned int fdi_sec;   /* FDI所在扇区 */
+    unsigned short fdi_off; /* FDI扇区内偏移 */
+    unsigned int first_clu; /* 首簇 */
+    unsigned int tail_clu;  /* 尾簇 */
+    unsigned int fl_sz;     /* 生成令牌时的文件大小 */
+    unsigned char name[11]; /* 8.3文件名 */
+    unsigned char crt[5];   /* 创建时间（10ms、时间、日期），FDI偏移13~17 */
+}yc_ftoken_t;
+/* 文件令牌错误码 */
+#define TOKEN_PARAM_ERR -1
+
+/* 由已打开的文件生成令牌，可保存后反复用于YC_FAT_OpenByToken */
+int YC_FAT_GetToken(FILE1 * fl,yc_ftoken_t *tk)
+{
+    if((NULL == fl) || (NULL == tk) || (FILE_OPEN != fl->file_state)) return TOKEN_PARAM_ERR;
+#if YC_FAT_DELALLOC
+    /* 令牌记录的是设备上的文件，先下发暂存数据 */
+    if(fl->da_len)
+    {
+        YC_FAT_DelallocFlush(fl);
+        YC_FAT_Commit();
+    }
+#endif
+    tk->fdi_sec = fl->fdi_info_t.fdi_sec;
+    tk->fdi_off = fl->fdi_info_t.fdi_off;
+    tk->first_clu = fl->FirstClu;
+    tk->tail_clu = fl->EndClu;
+    tk->fl_sz = fl->fl_sz;
+    YC_FAT_DevRead(buffer1,tk->fdi_sec,1);
+    YC_MemCpy(tk->name,buffer1+tk->fdi_off,11);
+    YC_MemCpy(tk->crt,buffer1+tk->fdi_off+13,5);
+    return 0;
+}
+
+/* 按令牌打开文件，只读一次目录项所在扇区进行校验 */
+/* 目录项已删除、文件名或创建时间不符、首簇改变或文件变小时令牌失效，返回NULL，调用者改用YC_FAT_OpenFile并重新生成令牌 */
+/* 大小不变时核对尾簇仍是簇链末尾（裁剪后又增长回原大小）；文件在生成令牌后变大时从首簇按文件大小定位尾簇， */
+/* 令牌中的尾簇可能已被裁剪释放并分配给其他文件，不能从它向后查找 */
+FILE1 * YC_FAT_OpenByToken(FILE1 * f_op,yc_ftoken_t *tk)
+{
+    FDI_t *fdi;unsigned char i;
+    if((NULL == f_op) || (NULL == tk) || (f_op->file_state == FILE_OPEN)) return NULL;
+    if(tk->fdi_off > PER_SECSIZE-sizeof(FDI_t)) return NULL;
+    YC_FAT_DevRead(buffer1,tk->fdi_sec,1);
+    fdi = (FDI_t *)(buffer1+tk->fdi_off);
+    if((0xE5 == fdi->fileName[0]) || (0x00 == fdi->fileName[0]) || (fdi->attribute & (TP_DIR|VOLUME)))
+        return NULL;
+    for(i = 0;i < 11;i++)
+        if(buffer1[tk->fdi_off+i] != tk->name[i]) return NULL;
+    for(i = 0;i < 5;i++)
+        if(buffer1[tk->fdi_off+13+i] != tk->crt[i]) return NULL;
+    YC_FAT_AnalyseFDI(fdi,f_op);
+    if((f_op->FirstClu != tk->first_clu) || (f_op->fl_sz < tk->fl_sz)) return NULL;
+    f_op->fdi_info_t.fdi_sec = tk->fdi_sec;
+    f_op->fdi_info_t.fdi_off = tk->fdi_off;
+    if(f_op->fl_sz == tk->fl_sz)
+    {
+        /* 尾簇不再是簇链末尾说明簇链已变，读一个FAT扇区即可确认 */
+        if(tk->tail_clu && ((YC_TakefileNextClu(tk->tail_clu) & 0x0fffffff) < 0x0ffffff8)) return NULL;
+        f_op->EndClu = tk->tail_clu;
+    }
+    else if(f_op->fl_sz)
+        f_op->EndClu = YC_FAT_TailBySize(f_op);
+    return YC_FAT_OpenSetup(f_op);
+}
+#endif
+
 /* 关闭文件 */
 int YC_FAT_Close(FILE1 * f_cl)
 {
     if(NULL == f_cl) return CLOSE_HOLE_FILE_ERR;
-	update_matchInfo(f_cl,2,1);
-	open_sem ++;
+    if(FILE_OPEN != f_cl->file_state) return CLOSE_NOT_OPEN_ERR;
+#if YC_FAT_ASYNC_IO
+    if(YC_FAT_AioBusy(f_cl)) return AIO_BUSY_ERR;/* 异步请求仍在使用句柄和簇链 */
+#endif
+#if YC_FAT_DELALLOC
+    /* 下发暂存数据，在释放预分配簇之前；失败时句柄保持打开，数据仍在暂存区，可稍后重试关闭 */
+    {
+        int ret = YC_FAT_DelallocClose(f_cl);
+        if(ret) return ret;
+    }
+#endif
+#if YC_FILE2MEM
+    /* 回写并释放内存映像 */
+    if(NULL != f_cl->mem)
+        YC_FAT_Writeback(f_cl,NULL,1);
+#endif
+#if YC_FAT_PREALLOC
+    /* 释放未用完的预分配簇 */
+    YC_FAT_TrimPrealloc(f_cl);
+#endif
+    YC_FAT_Commit();
+#if FILE_CACHE
+    /* 记录尾簇和区段表，下次打开不再遍历簇链 */
+    YC_FAT_CacheClose(f_cl);
+#endif
+	YC_FAT_OpenTabDel(f_cl);
     f_cl->CurClus_R = 0;
 #if !YC_FAT_MULT_SEC_READ
 	f_cl->CurOffSec = 0;
@@ -1794,6 +2850,9 @@ int YC_FAT_Close(FILE1 * f_cl)
 	f_cl->WRCluChainList.prev = NULL;
 	f_cl->fdi_info_t.fdi_off = 0;
 	f_cl->fdi_info_t.fdi_sec = 0;
+#if YC_FAT_DIRECT_IO
+	f_cl->oflag = YC_O_NORMAL;
+#endif
 	f_cl = NULL;
 	return 0;
 }
@@ -1812,7 +2871,7 @@ static unsigned int YC_FAT_MatchDirInClus(unsigned int clu,unsigned char *DIR)
     do{
         for(int i = 0;i < g_dbr[0].secPerClus;i++)
         {
-            usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
+            YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(fdi_clu)+i,1);
 
             /* 从buffer进行文件名匹配 */
             FDI_t *fdi = NULL;
@@ -2047,20 +3106,46 @@ unsigned int YC_FAT_GetCurWorkDir(void)
 static void YC_FAT_UpdateFSInfo(void)
 {
     FSINFO_t fsi,* pfsi = &fsi;
-    usr_read((unsigned char *)&fsi,g_mbr.dpt[0].partStartSec+1,1);
-    pfsi->Free_nClus[0] = FatInitArgs_a[0].FreeClusNum;
-    pfsi->Free_nClus[1] = FatInitArgs_a[0].FreeClusNum>>8;
-    pfsi->Free_nClus[2] = FatInitArgs_a[0].FreeClusNum>>16;
-    pfsi->Free_nClus[3] = FatInitArgs_a[0].FreeClusNum>>24;
-    usr_write((char *)&fsi,g_mbr.dpt[0].partStartSec+1,1);
+    YC_FAT_DevRead((unsigned char *)&fsi,g_mbr.dpt[0].partStartSec+1,1);
+    unsigned char dirty;
+    dirty = Value2Byte4Dirty(&FatInitArgs_a[0].FreeClusNum,pfsi->Free_nClus);
+    dirty |= Value2Byte4Dirty(&FatInitArgs_a[0].NextFreeClu,pfsi->Next_Free_Clus);/* 下次挂载的空闲簇提示 */
+    /* 空闲簇数目和提示都未变化时不回写 */
+    if(dirty)
+        YC_FAT_QueueWrite((char *)&fsi,g_mbr.dpt[0].partStartSec+1);
 }
 
-/* 读取FSINFO扇区 */
-static void YC_FAT_ReadInfoSec(unsigned int *leftnum)
+/* 读取FSINFO扇区，leftnum返回剩余空簇数，nexthint返回下一空闲簇提示 */
+static void YC_FAT_ReadInfoSec(unsigned int *leftnum,unsigned int *nexthint)
 {
     FSINFO_t fsinfo;
-    usr_read((unsigned char *)&fsinfo,g_mbr.dpt[0].partStartSec+1,1);
-    FatInitArgs_a[0].FreeClusNum = Byte2Value((unsigned char *)&fsinfo.Free_nClus,4);
+    YC_FAT_DevRead((unsigned char *)&fsinfo,g_mbr.dpt[0].partStartSec+1,1);
+    *leftnum = Byte2Value((unsigned char *)&fsinfo.Free_nClus,4);
+    *nexthint = Byte2Value((unsigned char *)&fsinfo.Next_Free_Clus,4);
+}
+
+/* FAT[1]的bit27为正常卸载标志，置1表示上次正常卸载，FSINFO中的统计可信 */
+#define FAT_CLN_SHUT_BIT 0x08000000
+
+/* 读取正常卸载标志 */
+static unsigned char YC_FAT_VolIsClean(void)
+{
+    FAT32_Sec_t fat_sec;
+    YC_FAT_DevRead((unsigned char *)&fat_sec,FatInitArgs_a[0].FAT1Sec,1);
+    return (Byte2Value((unsigned char *)&fat_sec.fat_sec[1],FAT_SIZE) & FAT_CLN_SHUT_BIT) ? 1 : 0;
+}
+
+/* 设置正常卸载标志，挂载后清除，卸载时置位 */
+static void YC_FAT_SetVolClean(unsigned char clean)
+{
+    FAT32_Sec_t fat_sec;
+    unsigned int v;
+    YC_FAT_DevRead((unsigned char *)&fat_sec,FatInitArgs_a[0].FAT1Sec,1);
+    v = Byte2Value((unsigned char *)&fat_sec.fat_sec[1],FAT_SIZE);
+    if(clean) v |= FAT_CLN_SHUT_BIT;
+    else v &= ~FAT_CLN_SHUT_BIT;
+    if(Value2Byte4Dirty(&v,(unsigned char *)&fat_sec.fat_sec[1]))
+        YC_FAT_QueueWrite((unsigned char *)&fat_sec,FatInitArgs_a[0].FAT1Sec);
 }
 
 /* 从FAT第一个扇区遍历FAT，寻找第一个空簇 */
@@ -2075,9 +3160,9 @@ static int YC_FAT_SeekFirstEmptyClus(unsigned int * d)
     for(k = 0; k < j; k++)
     {
         /* 取当前扇区所有FAT链 */
-        usr_read((unsigned char *)&fat_secA,fat_ss+k,1);
+        YC_FAT_DevRead((unsigned char *)&fat_secA,fat_ss+k,1);
 		fat = (FAT32_t *)&fat_secA.fat_sec[0];
-        for(; (unsigned int)fat < ((unsigned int)&fat_secA+sizeof(FAT32_Sec_t)); fat++)
+        for(; (unsigned int)fat < ((unsigned int)&fat_secA+PER_SECSIZE); fat++)
         {
             /* 找到一个空FAT */
             if(0x00 == *(unsigned int *)fat) {
@@ -2092,16 +3177,31 @@ static int YC_FAT_SeekFirstEmptyClus(unsigned int * d)
     return -1;
 }
 
+/* 遍历整个FAT统计空闲簇数，first返回第一个空闲簇，没有空闲簇时为0 */
+static unsigned int YC_FAT_CountFreeClus(unsigned int *first)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu,n = 0,end = CLU_END();
+    *first = 0;
+    for(clu = 2;clu < end;clu++)
+    {
+        if(0 != (YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff)) continue;
+        if(!n) *first = clu;
+        n++;
+    }
+    return n;
+}
+
 /* FAT表映射到位图,默认1个扇区的FAT */
 static int YC_FAT_RemapToBit(unsigned int start_sec)
 {
     FAT32_Sec_t fat_secA;
     unsigned int *pi = (unsigned int *)&fat_secA;
     unsigned char *pc = clusterBitmap;
-    unsigned char n = 0,k = 0;
+    unsigned char n = 0;unsigned short k = 0;
     YC_Memset(clusterBitmap, 0, sizeof(clusterBitmap));
     /* 先读出FAT扇区所有数据 */
-    usr_read((unsigned char *)&fat_secA,start_sec,1);
+    YC_FAT_DevRead((unsigned char *)&fat_secA,start_sec,1);
     /* 将整个FAT扇区映射到位图，0->0,!0->1 */
     while((unsigned int)pi < ((unsigned int)&fat_secA + PER_SECSIZE))
     {
@@ -2139,20 +3239,16 @@ static int YC_FAT_ExpandCluChain(unsigned int theclu,unsigned int nextclu)
     unsigned int t_rSec = off_sec + FatInitArgs_a[0].FAT1Sec; /* 默认取DBR0中的数据 */
 
     /* 取当前扇区所有FAT */
-    usr_read((unsigned char *)&fat_sec1,t_rSec,1);
+    YC_FAT_DevRead((unsigned char *)&fat_sec1,t_rSec,1);
 
     FAT32_t * fat = (FAT32_t * )&fat_sec1.fat_sec[0];
-    unsigned char off_fat = (off_b % PER_SECSIZE)/4;/* 计算在FAT中的偏移（以FAT大小为单位） */
+    unsigned short off_fat = (off_b % PER_SECSIZE)/4;/* 计算在FAT中的偏移（以FAT大小为单位） */
     fat += off_fat;
 
     /* 修改此簇的下一簇为nextclu */    
-    *(unsigned char *)(fat) = nextclu;
-    *((unsigned char *)(fat)+1) = nextclu >> 8;
-    *((unsigned char *)(fat)+2) = nextclu >> 16;
-    *((unsigned char *)(fat)+3) = nextclu >> 24;
-
-    /* 回写扇区 */
-    usr_write((unsigned char *)&fat_sec1,t_rSec,1);
+    /* 回写扇区，FAT项未变化时不回写 */
+    if(Value2Byte4Dirty(&nextclu,(unsigned char *)(fat)))
+        YC_FAT_QueueWrite((unsigned char *)&fat_sec1,t_rSec);
     return 0;
 }
 #define ARGVS_ERROR -99
@@ -2171,11 +3267,11 @@ static int YC_FAT_SeekNextFirstEmptyClu(unsigned int current_clu,unsigned int *
     for(;t_rSec < FatInitArgs_a[0].FAT1Sec + g_dbr[0].FATSz32;t_rSec ++)
     {
         /* 取当前扇区所有FAT */
-        usr_read((unsigned char *)&fat_sec1,t_rSec,1);
+        YC_FAT_DevRead((unsigned char *)&fat_sec1,t_rSec,1);
         fat = (FAT32_t * )&fat_sec1.fat_sec[0];
         fat = fat + (current_clu * FAT_SIZE % PER_SECSIZE)/4;
         /* 从当前FAT所在扇区偏移开始向后遍历 */
-        for(; (unsigned int)fat < ((unsigned int)&fat_sec1+sizeof(FAT32_Sec_t)); fat++)
+        for(; (unsigned int)fat < ((unsigned int)&fat_sec1+PER_SECSIZE); fat++)
         {
             current_clu ++;
             /* 找到一个FAT为0 */
@@ -2193,9 +3289,23 @@ static int YC_FAT_SeekNextFirstEmptyClu(unsigned int current_clu,unsigned int *
     return FOUND_FREE_CLU;
 }
 
+/* 设置卷扇区大小，只支持512到MAX_SECSIZE之间的2的幂 */
+static int YC_FAT_SetSecSize(unsigned short bps)
+{
+    if((bps < 512) || (bps > MAX_SECSIZE) || (bps & (bps-1)))
+        return -1;
+    g_secsz = bps;
+#if YC_FAT_ERASE_ALIGN
+    erase_blk = erase_blk512/(bps/512);
+#endif
+    return 0;
+}
+
 /* ycfat初始化 */
 int YC_FAT_Init(struct FilesystemOperations * fatobj)
 {
+    unsigned int hint;
+    unsigned char clean;
     //if(NULL == fatobj) return -1;
     /* 大小端检测 */
     endian_checker();
@@ -2207,18 +3317,44 @@ int YC_FAT_Init(struct FilesystemOperations * fatobj)
 #endif
     /* 解析DBR */
     YC_FAT_ReadDBR(&g_dbr[0]);
+    /* 按DBR中的扇区大小访问卷 */
+    if(0 != YC_FAT_SetSecSize(g_dbr[0].bytsPerSec)) return INIT_SECSIZE_ERR;
 
-    /* 遍历FAT表，寻找第一个空闲簇 */
-    if(-1 == YC_FAT_SeekFirstEmptyClus((unsigned int *)&FatInitArgs_a[0].NextFreeClu)) return -2;
-    /* 第一个空闲簇所在FAT扇区 */
-    cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
+    /* 读取FSINFO扇区，更新剩余空簇 */
+    YC_FAT_ReadInfoSec((unsigned int *)&FatInitArgs_a[0].FreeClusNum,&hint);
+
+    /* 上次正常卸载且提示有效时从提示处寻找空闲簇，通常只需读一个FAT扇区 */
+    clean = YC_FAT_VolIsClean();
+    if(!clean)
+    {
+        /* 上次未正常卸载，FSINFO中的空闲簇数不可信，遍历FAT重新统计，同时找出第一个空闲簇 */
+        FatInitArgs_a[0].FreeClusNum = YC_FAT_CountFreeClus((unsigned int *)&FatInitArgs_a[0].NextFreeClu);
+        if(0 == FatInitArgs_a[0].NextFreeClu) return -2;
+        YC_FAT_UpdateFSInfo();
+    }
+    else if((hint < 2) || (hint >= CLU_END()) || (FatInitArgs_a[0].FreeClusNum > CLU_END()-2) || \
+        (0 != YC_FAT_SeekNextFirstEmptyClu(hint-1,(unsigned int *)&FatInitArgs_a[0].NextFreeClu)))
+    {
+        /* 遍历FAT表，寻找第一个空闲簇 */
+        if(-1 == YC_FAT_SeekFirstEmptyClus((unsigned int *)&FatInitArgs_a[0].NextFreeClu)) return -2;
+    }
+    /* 第一个空闲簇所在FAT扇区 */
+    cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
 
     /* 找出第一个有空闲簇的FAT扇区 */
     if((FatInitArgs_a[0].NextFreeClu != 0xffffffff) && (FatInitArgs_a[0].NextFreeClu != 0))
         YC_FAT_RemapToBit(cur_fat_sec);
 
-    /* 读取FSINFO扇区，更新剩余空簇 */
-    YC_FAT_ReadInfoSec((unsigned int *)&FatInitArgs_a[0].FreeClusNum);
+#if FILE_CACHE
+    /* 清空文件缓存，上次正常卸载时读回保存的缓存 */
+    YC_FAT_CacheReset();
+#if FCACHE_PERSIST
+    YC_FAT_CacheLoad(&fatobj->ioopr,clean);
+#endif
+#endif
+    /* 挂载期间清除正常卸载标志，异常掉电后下次挂载不再信任FSINFO中的提示 */
+    YC_FAT_SetVolClean(0);
+    YC_FAT_Commit();
 		
     return 0;
 }
@@ -2357,7 +3493,7 @@ int YC_FAT_CreateFile(unsigned char *filepath)
         /* 遍历簇下所有扇区 */
         for(int i = 0;i < g_dbr[0].secPerClus;i++)
         {
-            usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
+            YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
             fdi = (FDI_t *)&fdis.fdi[0];
             /* 从当前扇区地址循环偏移固定字节取文件/目录名 */
             for( ; (unsigned int)fdi < (((unsigned int)&fdis)+PER_SECSIZE) ; fdi ++)
@@ -2365,8 +3501,9 @@ int YC_FAT_CreateFile(unsigned char *filepath)
                 if(0x00 == *(char *)fdi) 
                 {
                     YC_FAT_GenerateFDI(fdi,f_n,FDIT_FILE);
-                    /* 回写当前扇区并退出 */
-                    usr_write((char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
+                    /* 回写当前扇区并退出，目录扇区同其他元数据一起入队 */
+                    YC_FAT_QueueWrite((char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i);
+                    YC_FAT_Commit();
                     return CRT_FILE_OK;
                 }
                 /* 将目录簇中的8*3名转化为字符串类型 */
@@ -2391,14 +3528,15 @@ int YC_FAT_CreateFile(unsigned char *filepath)
     YC_FAT_ExpandCluChain(freeclu,0x0fffffff);
 
     /* 在新簇头部写入新fdi */
-    usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
+    YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
     fdi = (FDI_t *)&fdis.fdi[0];
     YC_FAT_GenerateFDI(fdi,f_n,FDIT_FILE);
-    usr_write((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
+    YC_FAT_QueueWrite((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu));
     
     /* 更新FSINFO扇区中的空簇数目 */
     FatInitArgs_a[0].FreeClusNum --;
     YC_FAT_UpdateFSInfo();
+    YC_FAT_Commit();
     /* 寻找下一空闲簇 */
     if(FatInitArgs_a[0].FreeClusNum){
         if(-1 == YC_FAT_SeekNextFirstEmptyClu(freeclu,(unsigned int *)&FatInitArgs_a[0].NextFreeClu))
@@ -2434,7 +3572,7 @@ static int YC_GenDirInClu(unsigned int thisclu,unsigned int p_clu)
 		fdi->startClusLower[0] = p_clu;
 		fdi->startClusLower[1] = p_clu >> 8;
 	}
-    usr_write((unsigned char *)&fdis,START_SECTOR_OF_FILE(thisclu),1);
+    YC_FAT_DevWrite((unsigned char *)&fdis,START_SECTOR_OF_FILE(thisclu),1);
     return 0;
 }
 
@@ -2470,7 +3608,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
         /* 遍历簇下所有扇区 */
         for(int i = 0;i < g_dbr[0].secPerClus;i++)
         {
-            usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
+            YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
             fdi = (FDI_t *)&fdis.fdi[0];
             /* 从当前扇区地址循环偏移固定字节取文件/目录名 */
             for( ; (unsigned int)fdi < (((unsigned int)&fdis)+PER_SECSIZE) ; fdi ++)
@@ -2485,7 +3623,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
                     fdi->startClusLower[0] = FatInitArgs_a[0].NextFreeClu;
                     fdi->startClusLower[1] = FatInitArgs_a[0].NextFreeClu >> 8;
 
-                    usr_write((char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i,1);
+                    YC_FAT_QueueWrite((char *)&fdis,START_SECTOR_OF_FILE(file_clu)+i);
                     YC_FAT_ExpandCluChain(FatInitArgs_a[0].NextFreeClu,0x0fffffff);
                     YC_GenDirInClu(FatInitArgs_a[0].NextFreeClu,file_clu);
                     freeclu = FatInitArgs_a[0].NextFreeClu;
@@ -2494,6 +3632,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
                     /* 更新FSINFO扇区中的空簇数目 */
                     FatInitArgs_a[0].FreeClusNum --;
                     YC_FAT_UpdateFSInfo();
+                    YC_FAT_Commit();
                     return CRT_DIR_OK;
                 }
                 /* 将目录簇中的8*3名转化为字符串类型 */
@@ -2523,7 +3662,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
     YC_FAT_ExpandCluChain(freeclu,0x0fffffff);
     YC_FAT_SeekNextFirstEmptyClu(freeclu,(unsigned int *)&FatInitArgs_a[0].NextFreeClu);
     /* 在当前目录扩展新簇头部写入新fdi */
-    usr_read((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
+    YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
     YC_Memset(&fdis, 0, sizeof(FDIs_t));
     fdi = (FDI_t *)&fdis.fdi[0];
     YC_FAT_GenerateFDI(fdi,f_n,FDIT_DIR);
@@ -2531,7 +3670,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
     fdi->startClusUper[1] = FatInitArgs_a[0].NextFreeClu >> 24;
     fdi->startClusLower[0] = FatInitArgs_a[0].NextFreeClu;
     fdi->startClusLower[1] = FatInitArgs_a[0].NextFreeClu >> 8;
-    usr_write((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu),1);
+    YC_FAT_QueueWrite((unsigned char *)&fdis,START_SECTOR_OF_FILE(freeclu));
 
     YC_FAT_ExpandCluChain(FatInitArgs_a[0].NextFreeClu,0x0fffffff);
     /* 在子目录新簇写入fdi */
@@ -2540,6 +3679,7 @@ int YC_FAT_CreateDir(unsigned char *dir)
     /* 更新FSINFO扇区中的空簇数目 */
     FatInitArgs_a[0].FreeClusNum -= 2;
     YC_FAT_UpdateFSInfo();
+    YC_FAT_Commit();
     /* 寻找下一空闲簇 */
     if(FatInitArgs_a[0].FreeClusNum){
         if(-1 == YC_FAT_SeekNextFirstEmptyClu(FatInitArgs_a[0].NextFreeClu,(unsigned int *)&FatInitArgs_a[0].NextFreeClu))
@@ -2568,7 +3708,7 @@ static int SeekNextFreeClu_BitMap(unsigned int clu)
     if(c == 7){
         p++;c=-1;
     }
-    for(;p < clusterBitmap + sizeof(clusterBitmap); p++)
+    for(;p < clusterBitmap + (PER_SECSIZE/FAT_SIZE)/8; p++)
     {
         if((*p & 0xff) == 0xff)
         {
@@ -2649,6 +3789,35 @@ static int YC_FAT_AddToList(FILE1 *fl,unsigned int clu)
 }
 
 /* 预建文件簇缓冲链（写） */
+#if YC_FAT_ERASE_ALIGN
+/* 将下一空闲簇调整到一个完全空闲的擦除块的起始簇，新文件的数据从擦除块边界开始整块写入 */
+/* 簇不小于擦除块时格式化已保证对齐，无需调整；在ERASE_ALIGN_SCAN个FAT扇区范围内找不到时保持原分配位置 */
+static void YC_FAT_AlignNextFreeClu(void)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int cpb,clu,end,k;
+    if((erase_blk <= g_dbr[0].secPerClus) || (erase_blk % g_dbr[0].secPerClus)) return;
+    clu = FatInitArgs_a[0].NextFreeClu;
+    if((clu < 2) || (clu == 0xffffffff)) return;
+    cpb = erase_blk/g_dbr[0].secPerClus;/* 每擦除块簇数 */
+    end = MIN(CLU_END(),clu+ERASE_ALIGN_SCAN*(PER_SECSIZE/FAT_SIZE));
+    k = (START_SECTOR_OF_FILE(clu) % erase_blk)/g_dbr[0].secPerClus;
+    if(k) clu += cpb-k;/* 前进到下一擦除块起始簇 */
+    for(;clu+cpb <= end;clu += cpb)
+    {
+        for(k = 0;k < cpb;k++)
+            if(0 != YC_TakefileNextClu_Cached(clu+k,&fat_sec,&cached_sec)) break;
+        if(k == cpb)
+        {
+            FatInitArgs_a[0].NextFreeClu = clu;
+            cur_fat_sec = CLU_TO_FATSEC(clu);
+            YC_FAT_RemapToBit(cur_fat_sec);
+            return;
+        }
+    }
+}
+#endif
+
 static int YC_FAT_CreateFileCluChain(FILE1 *fl,unsigned int cluNum)
 {
     unsigned int ret = 0;
@@ -2657,6 +3826,44 @@ static int YC_FAT_CreateFileCluChain(FILE1 *fl,unsigned int cluNum)
     /* 还原FatInitArgs_a[0].NextFreeClu备用1 */
     unsigned int bkclu1;
 	if(!cluNum) return ret;
+#if YC_FAT_PREALLOC
+    /* 预分配簇不够时在文件末尾预留一个窗口，交替追加的多个文件各自在自己的窗口内连续增长 */
+    /* 窗口优先紧接簇链末尾，其次在簇链末尾或父目录簇附近；都找不到时从全局分配位置按普通方式分配 */
+    /* 关闭文件时归还窗口未用的部分 */
+    if((cluNum > fl->PreNum) && (0 != YC_FAT_PreallocClus(fl,MAX(cluNum-fl->PreNum,(unsigned int)RESV_WINDOW),0)) && \
+        (cluNum-fl->PreNum < RESV_WINDOW))
+        YC_FAT_PreallocClus(fl,cluNum-fl->PreNum,0);/* 附近放不下整个窗口时只按需就近分配 */
+    /* 先取用预分配簇，它们已经链接在文件尾簇之后 */
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int pre_clu = fl->PreClu,pre_num = fl->PreNum;
+    fl->PreTaken = 0;
+    while(cluNum && fl->PreNum)
+    {
+        if(-1 == YC_FAT_AddToList(fl,fl->PreClu))
+        {
+            fl->PreClu = pre_clu;fl->PreNum = pre_num;fl->PreTaken = 0;
+            return -1;
+        }
+        fl->PreTaken++;fl->PreNum--;cluNum--;
+        if(fl->PreNum)
+            fl->PreClu = YC_TakefileNextClu_Cached(fl->PreClu,&fat_sec,&cached_sec) & 0x0fffffff;
+        else
+            fl->PreClu = fl->PreEnd = 0;
+    }
+    if(!cluNum) return ret;
+#endif
+#if YC_FAT_DEFER_FREE
+    /* 空闲簇不足时先回收延后释放的簇链 */
+    while((cluNum > FatInitArgs_a[0].FreeClusNum) && YC_FAT_Idle());
+#endif
+#if YC_FAT_ERASE_ALIGN
+    /* 新文件从擦除块边界开始分配 */
+    if(0 == fl->fl_sz)
+        YC_FAT_AlignNextFreeClu();
+#endif
+#if YC_FAT_DEFER_FREE || YC_FAT_ERASE_ALIGN
+    bkclu = FatInitArgs_a[0].NextFreeClu;
+#endif
     /* 遍历bit map，将0位存放到链表中 */
     while(cluNum--)
     {
@@ -2701,31 +3908,7 @@ static int YC_FAT_CreateFileCluChain(FILE1 *fl,unsigned int cluNum)
 }
 
 #if FAT2_ENABLE
-/* 将FAT1表全部备份至FAT2,耗时长约几分钟，不建议使用 */
-static void YC_FAT_BackedUpFAT2_A(void)
-{
-	unsigned int i = FatInitArgs_a[0].FAT1Sec;
-	unsigned int i1 = FatInitArgs_a[0].FAT1Sec+g_dbr[0].FATSz32;
-	unsigned int j;
-    /* 备份FAT1至FAT2 */
-    {
-		for(j=0;j<g_dbr[0].FATSz32;j++){
-			usr_read( buffer2,i+j,1);
-			usr_write(buffer2,i1+j,1);
-		}
-	}
-}
-/* 将FAT1表局部备份至FAT2,适用与缝合簇链时同时进行 */
-static void YC_FAT_BackedUpFAT2_1(unsigned int clu){
-    unsigned int sec = START_SECTOR_OF_FILE(clu);
-    usr_read(buffer2,sec,1);
-    usr_write(buffer2,sec+g_dbr[0].FATSz32,1);
-}
-
-/* 将FAT1表局部备份至FAT2，适用缝合簇链时后 */
-static void YC_FAT_BackedUpFAT2(FILE1 *f){
-
-}
+/* FAT1表局部备份至FAT2由元数据写队列完成，刷新队列时只镜像被修改过的FAT1扇区 */
 #endif
 
 /* 缝合簇链 */
@@ -2736,17 +3919,17 @@ static void YC_FAT_SewCluChain(FILE1 *fl)
 	unsigned short bootclu_l16 = 0,bootclu_h16 = 0;
 	unsigned temp,temp1,temp2;
 	unsigned int t_clu;//当前FAT表内最大约束
-	 unsigned char off_fat;/* 计算在FAT中的偏移（以FAT大小为单位） */
-    if(fl->fl_sz == 0)
+    /* 新文件且尾簇就是第一个新簇时才需要写目录项首簇，取用过预分配簇的空文件首簇已写入 */
+    if((fl->fl_sz == 0) && (fl->EndClu == ((w_buffer_t *)fl->WRCluChainList.next)->w_s_clu))
     {
 		bootclu = ((w_buffer_t *)fl->WRCluChainList.next)->w_s_clu;/*提取引导簇*/
 		bootclu_l16 = bootclu;
 		bootclu_h16 = bootclu>>16;
 		/* 新文件,先修改引导簇 */
-		usr_read(buffer1,fl->fdi_info_t.fdi_sec,1);
+		YC_FAT_DevRead(buffer1,fl->fdi_info_t.fdi_sec,1);
 		Value2Byte2((unsigned short *)&bootclu_h16,buffer1+fl->fdi_info_t.fdi_off+20);/* 修改文件引导簇的高16位 */
 		Value2Byte2((unsigned short *)&bootclu_l16,buffer1+fl->fdi_info_t.fdi_off+26);/* 修改文件引导簇的低16位 */
-		usr_write(buffer1,fl->fdi_info_t.fdi_sec,1);
+		YC_FAT_QueueWrite(buffer1,fl->fdi_info_t.fdi_sec);
 		fl->EndClu = bootclu;
 		/* 如果头节点中首尾簇相同那么删除头节点，否则头节点w_s_clu加1 */
         if(bootclu == ((w_buffer_t *)(fl->WRCluChainList.next))->w_e_clu)
@@ -2761,7 +3944,7 @@ static void YC_FAT_SewCluChain(FILE1 *fl)
 	
 	temp = fl->EndClu;
     if(!list_empty(&fl->WRCluChainList))
-	    usr_read(buffer1,CLU_TO_FATSEC(temp),1);/* 将本节点头簇FAT所在扇区读出来 */
+	    YC_FAT_DevRead(buffer1,CLU_TO_FATSEC(temp),1);/* 将本节点头簇FAT所在扇区读出来 */
     /* 遍历所有的簇链节点 */
     list_for_each_safe(pos, next, &fl->WRCluChainList)
     {
@@ -2773,15 +3956,15 @@ static void YC_FAT_SewCluChain(FILE1 *fl)
 			*(unsigned int *)(buffer1+TAKE_FAT_OFF(temp)*4) = temp1;
 			/* 前往下一节点 */
 			if(temp1 == temp2) {
-				usr_write(buffer1,CLU_TO_FATSEC(temp),1);
+				YC_FAT_QueueWrite(buffer1,CLU_TO_FATSEC(temp));
 				temp = temp2;
 				break;
 			}
 			//temp = temp1; 
 			/* 到达当前FAT所能表达的最大簇号时进行下一个循环 */
 			if(temp1 > t_clu){
-				usr_write(buffer1,CLU_TO_FATSEC(temp),1);
-				usr_read(buffer1,CLU_TO_FATSEC(temp1),1);/* 将本节点头簇FAT所在扇区读出来 */
+				YC_FAT_QueueWrite(buffer1,CLU_TO_FATSEC(temp));
+				YC_FAT_DevRead(buffer1,CLU_TO_FATSEC(temp1),1);/* 将本节点头簇FAT所在扇区读出来 */
 				temp = temp1;temp1++;
 				continue;//换扇区
 			}
@@ -2792,6 +3975,80 @@ static void YC_FAT_SewCluChain(FILE1 *fl)
 	YC_FAT_ExpandCluChain(temp,0x0fffffff);
 }
 
+#if YC_FAT_PREALLOC
+/* 从写缓冲簇链头部摘除n个预分配簇，返回最后摘除的簇 */
+static unsigned int YC_FAT_DropPrealloc(FILE1 *fl,unsigned int n)
+{
+    w_buffer_t *w;unsigned int k,last = 0;
+    while(n && !list_empty(&fl->WRCluChainList))
+    {
+        w = (w_buffer_t *)fl->WRCluChainList.next;
+        k = MIN(n,w->w_e_clu-w->w_s_clu+1);
+        last = w->w_s_clu+k-1;
+        n -= k;
+        if(last == w->w_e_clu)
+        {
+            list_del(&w->WRCluChainNode);
+            tFreeHeapforeach((void *)w);
+        }
+        else w->w_s_clu = last+1;
+    }
+    return last;
+}
+#endif
+
+/* 写文件收尾：缝合簇链，更新文件尾簇、文件大小、FDI和FSINFO，释放写缓冲簇链 */
+static void YC_FAT_WriteFinish(FILE1* fileInfo,unsigned int bkl,int to_alloc_num)
+{
+    struct list_head *pos,*tmp;
+#if YC_FAT_PREALLOC
+    /* 取用的预分配簇已经在簇链中，从写缓冲簇链摘除，不再缝合，也不计入新分配的簇数 */
+    if(fileInfo->PreTaken)
+    {
+        fileInfo->EndClu = YC_FAT_DropPrealloc(fileInfo,fileInfo->PreTaken);
+        to_alloc_num -= fileInfo->PreTaken;
+        fileInfo->PreTaken = 0;
+    }
+#endif
+	/* 缝合簇链，宁缺勿滥写法，不容易出现磁盘泄露 */
+	/* 缝合簇链阶段是最容易造成磁盘损坏的阶段，唯一原因是在这个过程中设备断电 */
+    if(to_alloc_num)
+        YC_FAT_SewCluChain(fileInfo);
+
+	/* 更新文件尾簇和文件大小和文件末簇未写大小 */
+#if YC_FAT_PREALLOC
+    if(!fileInfo->PreNum)/* 还有预分配簇时簇链末尾不是文件尾簇 */
+        fileInfo->EndClu = TakeFileClusList_Eftv(fileInfo->EndClu);
+#else
+	fileInfo->EndClu = TakeFileClusList_Eftv(fileInfo->EndClu);
+#endif
+	fileInfo->fl_sz = fileInfo->fl_sz+bkl;
+	fileInfo->EndCluLeftSize = PER_SECSIZE*g_dbr[0].secPerClus-(fileInfo->fl_sz)%(PER_SECSIZE*g_dbr[0].secPerClus);
+	fileInfo->left_sz += bkl;
+	if(fileInfo->EndCluLeftSize == PER_SECSIZE*g_dbr[0].secPerClus)/* 临界处理 */
+		fileInfo->EndCluLeftSize = 0;	
+	/* 更新文件目录项FDI中的文件大小 */
+	YC_FAT_DevRead(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
+	if(Value2Byte4Dirty((unsigned int *)&fileInfo->fl_sz,buffer1+fileInfo->fdi_info_t.fdi_off+28))
+		YC_FAT_QueueWrite(buffer1,fileInfo->fdi_info_t.fdi_sec);
+
+    /* 删除写压缩缓冲簇链，释放内存 */
+    list_for_each_safe(pos, tmp, &fileInfo->WRCluChainList)
+    {
+        list_del(pos);
+        tFreeHeapforeach((void *)pos);
+    }
+    INIT_LIST_HEAD(&fileInfo->WRCluChainList);
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    if(to_alloc_num) YC_FAT_ExtentsInvalidate(fileInfo);/* 簇链变长 */
+#endif
+#if YC_FAT_DEFRAG
+    YC_FAT_NoteModify(fileInfo);
+#endif
+    FatInitArgs_a[0].FreeClusNum -= to_alloc_num;
+    YC_FAT_UpdateFSInfo();/* 更新FSINFO扇区 */
+}
+
 /* 写文件，在文件末尾追加数据 */
 //对于多文件并发写入时，采用一些策略（如锁机制，信号量机制等）来优化簇的分配，确保并发写入的正确性，裸机程序不需要考虑这类情况
 //除了写文件外，调用其他任何与线程安全相关的代码必须使用锁机制，裸机程序不需要考虑这类情况
@@ -2880,15 +4137,15 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
                 j = ((w_buffer_t *)pos)->w_e_clu-((w_buffer_t *)pos)->w_s_clu+1;
                 if(sec2wr1 == sec2wr)
                 {
-                    usr_write(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr-k*PER_SECSIZE*g_dbr[0].secPerClus);
+                    YC_FAT_VecWrite(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr-k*PER_SECSIZE*g_dbr[0].secPerClus);
                 }
                 else
                 {
-                    usr_write(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr1-k*PER_SECSIZE*g_dbr[0].secPerClus);
+                    YC_FAT_VecWrite(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr1-k*PER_SECSIZE*g_dbr[0].secPerClus);
                     /* 剩余不足一扇区的数据 */
-                    YC_Memset(buffer1,0,sizeof(buffer1));//已经写完的扇区数为 k*g_dbr[0].secPerClus+sec2wr1
-                    YC_MemCpy(buffer1,d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus)+sec2wr1*PER_SECSIZE,wr_size-(k*g_dbr[0].secPerClus+sec2wr1)*PER_SECSIZE);
-                    usr_write(buffer1,i+sec2wr1-k*g_dbr[0].secPerClus,1);
+                    YC_Memset(buffer0,0,sizeof(buffer0));//已经写完的扇区数为 k*g_dbr[0].secPerClus+sec2wr1
+                    YC_MemCpy(buffer0,d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus)+sec2wr1*PER_SECSIZE,wr_size-(k*g_dbr[0].secPerClus+sec2wr1)*PER_SECSIZE);
+                    YC_FAT_VecWrite(buffer0,i+sec2wr1-k*g_dbr[0].secPerClus,1);
                 }
             }
             else
@@ -2896,7 +4153,7 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
                 /* 尾节点簇前的簇链可以全写 */
                 i = START_SECTOR_OF_FILE(((w_buffer_t *)pos)->w_s_clu);
                 j = ((w_buffer_t *)pos)->w_e_clu-((w_buffer_t *)pos)->w_s_clu+1;
-                usr_write(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,j*g_dbr[0].secPerClus);
+                YC_FAT_VecWrite(d_buf+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,j*g_dbr[0].secPerClus);
                 k = k + j;/* 写完的簇数 */
             }
         }
@@ -2912,43 +4169,49 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
             if((PER_SECSIZE-off_byte)>=wr_size)/* 如果数据不足起始偏移扇区 */
             {
                 /* 先将原始数据读出来 */
-                usr_read(buffer1,i+off_sec,1);
+                YC_FAT_DevRead(buffer1,i+off_sec,1);
                 /* 将要写入的数据添加到缓冲区末尾 */
                 YC_MemCpy(buffer1+off_byte,d_buf,wr_size);
                 /* 重新写入数据 */
-                usr_write(buffer1,i+off_sec,1);
+                YC_FAT_VecWrite(buffer1,i+off_sec,1);
             }
             else{
                 sec2wr1 = sec2wr = (wr_size-(PER_SECSIZE-off_byte))/PER_SECSIZE;//补完一扇区后需要的额外扇区数
                 if((wr_size-(PER_SECSIZE-off_byte))%PER_SECSIZE)
                     sec2wr ++;
                 /*先补一扇区*/
-                usr_read(buffer1,i+off_sec,1);
+                YC_FAT_DevRead(buffer1,i+off_sec,1);
                 YC_MemCpy(buffer1+off_byte,d_buf,PER_SECSIZE-off_byte);
-                usr_write(buffer1,i+off_sec,1);
+                YC_FAT_VecWrite(buffer1,i+off_sec,1);
 
                 if(sec2wr1==sec2wr)
-                    usr_write(d_buf,i+off_sec+1,sec2wr);
+                    YC_FAT_VecWrite(d_buf,i+off_sec+1,sec2wr);
                 else
                 {
-                    usr_write(d_buf,i+off_sec+1,sec2wr1);
+                    YC_FAT_VecWrite(d_buf,i+off_sec+1,sec2wr1);
                     /* 剩余不足一扇区的数据 */
-                    YC_Memset(buffer1,0,sizeof(buffer1));
-                    YC_MemCpy(buffer1,d_buf+sec2wr1*PER_SECSIZE+(PER_SECSIZE-off_byte),wr_size-sec2wr1*PER_SECSIZE-(PER_SECSIZE-off_byte));
-                    usr_write(buffer1,sec2wr1+i+off_sec+1,1);
+                    YC_Memset(buffer0,0,sizeof(buffer0));
+                    YC_MemCpy(buffer0,d_buf+sec2wr1*PER_SECSIZE+(PER_SECSIZE-off_byte),wr_size-sec2wr1*PER_SECSIZE-(PER_SECSIZE-off_byte));
+                    YC_FAT_VecWrite(buffer0,sec2wr1+i+off_sec+1,1);
                 }
             }
+            YC_FAT_VecSubmit();/* 所有段一次提交 */
             /* 更新文件尾簇和文件大小和文件末簇未写大小 */
+#if YC_FAT_PREALLOC
+            if(!fileInfo->PreNum)/* 还有预分配簇时簇链末尾不是文件尾簇 */
+                fileInfo->EndClu = TakeFileClusList_Eftv(fileInfo->EndClu);
+#else
             fileInfo->EndClu = TakeFileClusList_Eftv(fileInfo->EndClu);
+#endif
             fileInfo->fl_sz = fileInfo->fl_sz+bkl;
             fileInfo->EndCluLeftSize = PER_SECSIZE*g_dbr[0].secPerClus-(fileInfo->fl_sz)%(PER_SECSIZE*g_dbr[0].secPerClus);
 			fileInfo->left_sz += wr_size;
             if(fileInfo->EndCluLeftSize == PER_SECSIZE*g_dbr[0].secPerClus)/* 临界处理 */
                 fileInfo->EndCluLeftSize = 0;			
             /* 更新文件目录项FDI中的文件大小 */
-            usr_read(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
-            Value2Byte4((unsigned int *)&fileInfo->fl_sz,buffer1+fileInfo->fdi_info_t.fdi_off+28);
-            usr_write(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
+            YC_FAT_DevRead(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
+            if(Value2Byte4Dirty((unsigned int *)&fileInfo->fl_sz,buffer1+fileInfo->fdi_info_t.fdi_off+28))
+                YC_FAT_QueueWrite(buffer1,fileInfo->fdi_info_t.fdi_sec);
             /* 无需修改簇链，直接返回即可 */
             return 0;
         }
@@ -2962,11 +4225,11 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
 			{
 				/* 先补一扇区 */
 				i = START_SECTOR_OF_FILE(fileInfo->EndClu);
-				usr_read(buffer1,i+off_sec,1);
+				YC_FAT_DevRead(buffer1,i+off_sec,1);
 				YC_MemCpy(buffer1+off_byte,d_buf,PER_SECSIZE-off_byte);
-				usr_write(buffer1,i+off_sec,1);
+				YC_FAT_VecWrite(buffer1,i+off_sec,1);
 				/* 再将当前簇剩余扇区补满 */
-				usr_write(d_buf+PER_SECSIZE-off_byte,i+off_sec+1,g_dbr[0].secPerClus-off_sec-1);
+				YC_FAT_VecWrite(d_buf+PER_SECSIZE-off_byte,i+off_sec+1,g_dbr[0].secPerClus-off_sec-1);
 			}
 
             sec2wr1 = sec2wr = (wr_size-fileInfo->EndCluLeftSize)/PER_SECSIZE;
@@ -2984,16 +4247,16 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
                     j = ((w_buffer_t *)pos)->w_e_clu-((w_buffer_t *)pos)->w_s_clu+1;
                     if(sec2wr1 == sec2wr)
                     {
-                        usr_write(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr);
+                        YC_FAT_VecWrite(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr);
                     }
                     else
                     {
-                        usr_write(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr1);
+                        YC_FAT_VecWrite(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,sec2wr1);
                         /* 剩余不足一扇区的数据 */
-                        YC_Memset(buffer1,0,sizeof(buffer1));
-                        YC_MemCpy(buffer1,d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus)+sec2wr1*PER_SECSIZE,\
+                        YC_Memset(buffer0,0,sizeof(buffer0));
+                        YC_MemCpy(buffer0,d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus)+sec2wr1*PER_SECSIZE,\
                                             wr_size-(k*g_dbr[0].secPerClus+sec2wr1)*PER_SECSIZE-fileInfo->EndCluLeftSize);
-                        usr_write(buffer1,i+sec2wr1-k*g_dbr[0].secPerClus,1);
+                        YC_FAT_VecWrite(buffer0,i+sec2wr1-k*g_dbr[0].secPerClus,1);
                     }
                 }
                 else
@@ -3001,47 +4264,81 @@ static int YC_WriteDataCheck(FILE1* fileInfo,unsigned char * d_buf,unsigned int
                     /* 尾节点簇前的簇链可以全写 */
                     i = START_SECTOR_OF_FILE(((w_buffer_t *)pos)->w_s_clu);
                     j = ((w_buffer_t *)pos)->w_e_clu-((w_buffer_t *)pos)->w_s_clu+1;
-                    usr_write(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,j*g_dbr[0].secPerClus);
+                    YC_FAT_VecWrite(d_buf+fileInfo->EndCluLeftSize+(k*PER_SECSIZE*g_dbr[0].secPerClus),i,j*g_dbr[0].secPerClus);
                     k = k + j;/* 写完的簇数 */
                 }
             }
         }
     }
-	/* 缝合簇链，宁缺勿滥写法，不容易出现磁盘泄露 */
-	/* 缝合簇链阶段是最容易造成磁盘损坏的阶段，唯一原因是在这个过程中设备断电 */
-    YC_FAT_SewCluChain(fileInfo);
+    YC_FAT_VecSubmit();/* 所有段一次提交 */
+    YC_FAT_WriteFinish(fileInfo,bkl,to_alloc_num);
+    return 0;
+}
 
-	/* 更新文件尾簇和文件大小和文件末簇未写大小 */
-	fileInfo->EndClu = TakeFileClusList_Eftv(fileInfo->EndClu);
-	fileInfo->fl_sz = fileInfo->fl_sz+bkl;
-	fileInfo->EndCluLeftSize = PER_SECSIZE*g_dbr[0].secPerClus-(fileInfo->fl_sz)%(PER_SECSIZE*g_dbr[0].secPerClus);
-	fileInfo->left_sz += wr_size;
-	if(fileInfo->EndCluLeftSize == PER_SECSIZE*g_dbr[0].secPerClus)/* 临界处理 */
-		fileInfo->EndCluLeftSize = 0;	
-	/* 更新文件目录项FDI中的文件大小 */
-	usr_read(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
-	Value2Byte4((unsigned int *)&fileInfo->fl_sz,buffer1+fileInfo->fdi_info_t.fdi_off+28);
-	usr_write(buffer1,fileInfo->fdi_info_t.fdi_sec,1);
+#if YC_FAT_DIRECT_IO
+/* 直接I/O写，在文件末尾追加数据 */
+/* 文件大小和len都必须扇区对齐，数据从用户缓冲区直接写入设备，每段连续簇链一次多扇区写 */
+static int YC_WriteDataDirect(FILE1* fileInfo,unsigned char * d_buf,unsigned int len)
+{
+    if(NULL == fileInfo)
+        return WRITE_FILE_PARAM_ERR;
+    if(FILE_OPEN != fileInfo->file_state)
+        return WRITE_FILE_CLOSED_ERR;
+    if(0 == len)
+        return WRITE_FILE_LENGTH_WARN;
+    if((fileInfo->fl_sz%PER_SECSIZE) || (len%PER_SECSIZE))
+        return DIRECT_IO_ALIGN_ERR;
+    /*保证文件不大于4G*/
+    if((len + fileInfo->fl_sz) < fileInfo->fl_sz)
+        return WRITE_FILE_PARAM_ERR;
 
-#if FAT2_ENABLE
-    /* 备份FAT1至FAT2 */
-    YC_FAT_BackedUpFAT2(fileInfo);
-#endif
-    /* 删除写压缩缓冲簇链，释放内存 */
-    list_for_each_safe(pos, tmp, &fileInfo->WRCluChainList)
+    struct list_head *pos;
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int w_off = 0,n;
+    int to_alloc_num = 0;
+
+    /* 计算需要的空闲簇数，尾簇剩余空间同样是扇区对齐的 */
+    if(len > fileInfo->EndCluLeftSize)
     {
-        list_del(pos);
-        tFreeHeapforeach((void *)pos);
+        to_alloc_num = (len - fileInfo->EndCluLeftSize)/clu_size;
+        if((len - fileInfo->EndCluLeftSize)%clu_size) to_alloc_num++;
+        if(0 > YC_FAT_CreateFileCluChain(fileInfo,to_alloc_num))
+            return -1;/* 簇链分配失败 */
     }
-    INIT_LIST_HEAD(&fileInfo->WRCluChainList);
-    FatInitArgs_a[0].FreeClusNum -= to_alloc_num;
-    YC_FAT_UpdateFSInfo();/* 更新FSINFO扇区 */
+    if(0 == fileInfo->fl_sz)/* 新文件 */
+    {
+        fileInfo->CurClus_R = fileInfo->FirstClu = \
+        fileInfo->EndClu = ((w_buffer_t *)fileInfo->WRCluChainList.next)->w_s_clu;
+    }
+    else if(fileInfo->EndCluLeftSize)
+    {
+        /* 先写满尾簇剩余扇区 */
+        n = MIN(len, fileInfo->EndCluLeftSize);
+        YC_FAT_VecWrite(d_buf,START_SECTOR_OF_FILE(fileInfo->EndClu)+(clu_size-fileInfo->EndCluLeftSize)/PER_SECSIZE,n/PER_SECSIZE);
+        w_off += n;
+    }
+    /* 再逐段写入新分配的连续簇链 */
+    list_for_each(pos, &fileInfo->WRCluChainList)
+    {
+        if(w_off >= len) break;
+        n = (((w_buffer_t *)pos)->w_e_clu-((w_buffer_t *)pos)->w_s_clu+1)*clu_size;
+        n = MIN(len-w_off, n);
+        YC_FAT_VecWrite(d_buf+w_off,START_SECTOR_OF_FILE(((w_buffer_t *)pos)->w_s_clu),n/PER_SECSIZE);
+        w_off += n;
+    }
+    YC_FAT_VecSubmit();/* 所有段一次提交 */
+    YC_FAT_WriteFinish(fileInfo,len,to_alloc_num);
     return 0;
 }
+#endif
 
 unsigned int YC_FAT_TakeFileSize(FILE1 * fl)
 {
+#if YC_FAT_DELALLOC
+    return fl->fl_sz+fl->da_len;/* 含暂存未写入的数据 */
+#else
     return fl->fl_sz;
+#endif
 }
 
 int YC_FAT_flseek0(FILE1* fileInfo)
@@ -3059,143 +4356,1665 @@ int YC_FAT_flseek0(FILE1* fileInfo)
 /* 写文件 */
 int YC_FAT_Write(FILE1* fileInfo,unsigned char * d_buf,unsigned int len)
 {
+    int ret = 0;
+#if YC_FILE2MEM
+    /* 映像按加载时的大小建立，文件加载期间不能改变 */
+    if((NULL != fileInfo) && (NULL != fileInfo->mem))
+        return WRITE_FILE_MEM_ERR;
+#endif
+#if YC_FAT_ASYNC_IO
+    if((NULL != fileInfo) && YC_FAT_AioBusy(fileInfo))
+        return AIO_BUSY_ERR;
+#endif
+#if YC_FAT_DELALLOC
+    if((NULL != fileInfo) && (FILE_OPEN == fileInfo->file_state) && (NULL != fileInfo->da_buf))
+        ret = YC_FAT_DelallocWrite(fileInfo,d_buf,len);/* 暂存，下发时才分配簇 */
+    else
+#endif
+#if YC_FAT_DIRECT_IO
+    if((NULL != fileInfo) && (fileInfo->oflag & YC_O_DIRECT))
+        ret = YC_WriteDataDirect(fileInfo,d_buf,len);/* 不对齐时返回错误码，不做中转拷贝 */
+    else
+#endif
     if(1)
 	    YC_WriteDataCheck(fileInfo,d_buf,len);//追加数据
-	return 0;
-}
-
-/* 查找文件，返回文件对象 */
-static FILE1 YC_FAT_SeekFile(unsigned char * filepath)
-{
-    FILE1 file = {0};
-    unsigned char fp[50];
-    unsigned int file_clu = 0;
-	unsigned char len1,len2;
-    DelexcSpace(filepath,fp);
-	len1 =  YC_StrLen(fp);
-    unsigned char f_n[50] = {0};
-    if(!YC_FAT_TakeFN(fp,f_n)) return file;
-	len2 =  YC_StrLen(f_n);
-    unsigned char f_p[50] = {0};
-	if(len1-len2) YC_StrCpy_l(f_p,fp,len1-len2);
-    if(!IS_FILENAME_ILLEGAL(f_n)) return file;
-    /* 进入文件目录，这里假设是标准绝对路径寻找文件 */
-    file_clu = YC_FAT_EnterDir(f_p);
-    YC_FAT_MatchFile(file_clu,&file,f_n);
-    return file;
+    /* 数据已直接写入，最后按LBA顺序下发FAT、FDI和FSINFO扇区 */
+    YC_FAT_Commit();
+	return ret;
 }
 
-/* 销毁簇链 */
-static int YC_FAT_DestroyCluChain(unsigned int bootclu)
+/* 随机写，从文件偏移off处覆盖写入len字节，超过文件末尾的部分追加写入 */
+/* 偏移按簇链换算到扇区，只有首尾不完整的扇区读-改-写，整扇区直接写入，物理连续的簇合并下发 */
+/* off不能超过文件大小（不支持空洞） */
+int YC_FAT_WriteAt(FILE1* fileInfo,unsigned int off,unsigned char * d_buf,unsigned int len)
 {
-	/* 销毁簇链 */
-    unsigned int clu = bootclu;
-	unsigned int bk1,bk2,bk3;
-    unsigned int *p = NULL;unsigned int *this = NULL;
-    unsigned char off_fat = ((clu * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;/* 计算在FAT中的偏移（以FAT大小为单位） */
-    do
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int clu,clu_base,pos,end,in_clu,sec,n,k;
+    if(NULL == fileInfo)
+        return WRITE_FILE_PARAM_ERR;
+#if YC_FAT_ASYNC_IO
+    if(YC_FAT_AioBusy(fileInfo))
+        return AIO_BUSY_ERR;
+#endif
+    if(FILE_OPEN != fileInfo->file_state)
+        return WRITE_FILE_CLOSED_ERR;
+    if(0 == len)
+        return WRITE_FILE_LENGTH_WARN;
+#if YC_FILE2MEM
+    if(NULL != fileInfo->mem)
+        return WRITE_FILE_MEM_ERR;/* 映像会覆盖设备上的新数据 */
+#endif
+#if YC_FAT_DELALLOC
+    /* 覆盖范围可能落在暂存数据中，先下发 */
+    if(fileInfo->da_len) YC_FAT_DelallocFlush(fileInfo);
+#endif
+    if(off > fileInfo->fl_sz)
+        return WRITE_FILE_PARAM_ERR;
+#if YC_FAT_DIRECT_IO
+    if((fileInfo->oflag & YC_O_DIRECT) && ((off%PER_SECSIZE) || (len%PER_SECSIZE)))
+        return DIRECT_IO_ALIGN_ERR;
+#endif
+    /* 覆盖文件已有数据的部分 */
+    end = off+MIN(len,fileInfo->fl_sz-off);
+    if(off < end)
     {
-		unsigned int h_clu = clu-off_fat;//当前FAT表内约束1
-		unsigned int t_clu = h_clu+(PER_SECSIZE/FAT_SIZE)-1;//当前FAT表内约束2
-        this = p = (unsigned int *)buffer3 + off_fat;
-		/* 读出段簇所在扇区数据 */
-		usr_read(buffer3,CLU_TO_FATSEC(clu),1);
-        bk1 = bk2 = *(unsigned int*)this;
-		bk3 = clu;
-		*this = 0;
-        for(;;)
+        /* 定位偏移所在簇，优先查共享区段表 */
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+        clu = YC_FAT_ExtentClu(fileInfo,off/clu_size);
+        if(!clu)
+#endif
         {
-            *this = 0;
-			/* 在当前FAT扇区内逐个遍历，碰到段尾簇就寻找下一个段簇，继续读出下一段簇所在FAT扇区 */
-            if( (bk1 > t_clu) || (bk1 < h_clu) )
+            clu = fileInfo->FirstClu;
+            for(k = off/clu_size;k;k--)
+                clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        }
+        clu_base = off-off%clu_size;
+        for(pos = off;pos < end;pos += n)
+        {
+            if(pos == clu_base+clu_size)
             {
-				usr_write(buffer3,CLU_TO_FATSEC(clu),1);
-                clu = bk2;
-                break;
+                clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+                clu_base += clu_size;
+            }
+            in_clu = pos-clu_base;
+            sec = START_SECTOR_OF_FILE(clu)+in_clu/PER_SECSIZE;
+            if((in_clu%PER_SECSIZE) || (end-pos < PER_SECSIZE))
+            {
+                /* 首尾不完整的扇区，读-改-写 */
+                n = MIN(PER_SECSIZE-in_clu%PER_SECSIZE,end-pos);
+                YC_FAT_DevRead(buffer0,sec,1);
+                YC_MemCpy(buffer0+in_clu%PER_SECSIZE,d_buf+(pos-off),n);
+                YC_FAT_DevWrite(buffer0,sec,1);
+            }
+            else
+            {
+                /* 本簇内的整扇区，相邻簇的段在段表中自动合并 */
+                n = MIN((end-pos)/PER_SECSIZE,(clu_size-in_clu)/PER_SECSIZE)*PER_SECSIZE;
+                YC_FAT_VecWrite(d_buf+(pos-off),sec,n/PER_SECSIZE);
             }
-			bk3 = bk1 = bk2;
-			p = ((unsigned int *)buffer3+TAKE_FAT_OFF(bk2));
-			this = p;bk1 = bk2 = *p;
         }
-		off_fat = (((unsigned int)(clu) * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;
-    }while(!IS_EOF(clu));
-#if YC_FAT_DEBUG
-	printf("deleted file tail clu is%d\r\n",bk3);
+        YC_FAT_VecSubmit();
+#if YC_FAT_DEFRAG
+        YC_FAT_NoteModify(fileInfo);/* 原地覆盖，大小和首簇都不变 */
 #endif
-    return bk3;
+    }
+    /* 超过文件末尾的部分追加写入 */
+    if(end-off < len)
+        return YC_FAT_Write(fileInfo,d_buf+(end-off),len-(end-off));
+    return 0;
 }
 
-/* 删除文件 */
-int YC_FAT_Del_File(unsigned char *file_path)
+#if YC_FAT_ASYNC_IO
+/* 异步读写完成回调，在YC_FAT_AsyncPoll中（线程上下文）调用，result为传输字节数或错误码 */
+typedef void (*yc_aio_cb_t)(FILE1 *file,int result,void *arg);
+/* 异步读写上下文，同一时刻只支持一个异步请求 */
+/* 设备传输当前段的同时，在线程中遍历FAT准备下一段，当前段传输完成中断中直接提交已准备好的下一段 */
+static struct {
+    FILE1 *file;
+    unsigned char *buf;           /* 用户缓冲区 */
+    unsigned int buf_off;         /* 已准备数据在用户缓冲区中的偏移 */
+    unsigned int t_size;          /* 本次读写的总字节数 */
+    unsigned char wr;             /* 0读 1写 */
+    unsigned char busy;
+    unsigned int sec_left;        /* 尚未准备的扇区数 */
+    unsigned int clu;             /* 读：正在合并的段的末簇 */
+    struct list_head *wpos;       /* 写：下一个写缓冲簇链节点 */
+    unsigned int bd_sec,bd_num;   /* 读：正在合并的段 */
+    int to_alloc_num;             /* 写：本次分配的簇数 */
+    unsigned int bk_first,bk_end; /* 写：提交前的首簇和尾簇，出错时还原 */
+    unsigned char * volatile nx_buf;    /* 已准备好的下一段 */
+    volatile unsigned int nx_sec,nx_num;
+    volatile unsigned char nx_ready;
+    volatile unsigned char inflight;    /* 设备上正在传输的段数 */
+    volatile char err;
+    FAT32_Sec_t fat_sec;unsigned int cached_sec;
+    yc_aio_cb_t cb;void *arg;
+}yc_aio;
+
+/* 异步请求未完成且作用于fl（fl为NULL时任意文件）时返回1，按FDI位置比较，同一文件的其他句柄同样视为忙 */
+static unsigned char YC_FAT_AioBusy(FILE1 *fl)
 {
-    if(NULL == file_path) return 0;
-    FILE1 file = YC_FAT_SeekFile(file_path);
-    if(file.FirstClu <= 2){
-#if YC_FAT_DEBUG
-		printf("需要删除的文件不存在\r\n");
-#endif
-		return DEL_FILE_OPENED_ERR;
-	}
-	if(1 == update_matchInfo(&file,2,2))
-	{
-#if YC_FAT_DEBUG
-		printf("文件已打开，删除失败\r\n");
-#endif
-		return -2;
-	}
-    if(!file.FirstClu){
-        /* 修改此文件的文件目录项的部分字段 */
-        usr_read(buffer1,file.fdi_info_t.fdi_sec,1);
-		*(buffer1+file.fdi_info_t.fdi_off) = 0xE5;//FDI第一个字节标记为0xE5
-#if 1 /* 这一步不清楚需不需要 */
-		*(buffer1+file.fdi_info_t.fdi_off+20) = *(buffer1+file.fdi_info_t.fdi_off+21) = 0;//FDI高位簇两字节标记为0x00
-#endif
-        usr_write(buffer1,file.fdi_info_t.fdi_sec,1);
-        return 0;
-    }
-	/* 修改此文件的文件目录项的部分字段 */
-    usr_read(buffer1,file.fdi_info_t.fdi_sec,1);
-	*(buffer1+file.fdi_info_t.fdi_off) = 0xE5;//FDI第一个字节标记为0xE5
-	*(buffer1+file.fdi_info_t.fdi_off+20) = *(buffer1+file.fdi_info_t.fdi_off+21) = 0;//FDI高位簇两字节标记为0x00
-    usr_write(buffer1,file.fdi_info_t.fdi_sec,1);
-	/* 销毁簇链 */
-    YC_FAT_DestroyCluChain(file.FirstClu);
-	return 0;
+    if(!yc_aio.busy) return 0;
+    if(NULL == fl) return 1;
+    return (yc_aio.file->fdi_info_t.fdi_sec == fl->fdi_info_t.fdi_sec)
+        && (yc_aio.file->fdi_info_t.fdi_off == fl->fdi_info_t.fdi_off);
 }
 
-/* 重命名文件,file_name路径可以是任意路径 */
-int YC_FAT_RenameFile(unsigned char *file_path,unsigned char *file_name)
+static void YC_FAT_AioSubmit(unsigned char *buf,unsigned int sec,unsigned int num);
+/* 段传输完成回调，可能在中断中执行 */
+static void YC_FAT_AioCplt(void *arg,char status)
 {
-	if(NULL == file_path) return -1;
-	FILE1 file = YC_FAT_SeekFile(file_path);
-	    if(file.fdi_info_t.fdi_sec == 0){
-#if YC_FAT_DEBUG
-		printf("需要重命名的文件不存在\r\n");
-#endif
-		return -1;
-	}
-	unsigned char fn[11] = {0};
-	/* file_name预处理 */
-	unsigned char fp[50] = {0};
-	DelexcSpace(file_name,fp);
-	unsigned char f_n[20] = {0};
-	if(!YC_FAT_TakeFN(fp,f_n)) return -2;
-	if(!IS_FILENAME_ILLEGAL(f_n)) return -3;
-	/* 修改文件目录项中的文件名 */
-    usr_read(buffer1,file.fdi_info_t.fdi_sec,1);
-	Genfilename_s(f_n,fn);
-    YC_StrCpy_l((unsigned char *)buffer1+file.fdi_info_t.fdi_off,fn,sizeof(fn));/* re-fill file name */
-    usr_write(buffer1,file.fdi_info_t.fdi_sec,1);
-	return 0;
+    unsigned char *buf;unsigned int sec,num;
+    (void)arg;
+    if(status) yc_aio.err = status;
+    yc_aio.inflight = 0;
+    /* 下一段已准备好，直接提交，使设备保持忙碌 */
+    if(yc_aio.nx_ready && !yc_aio.err)
+    {
+        buf = yc_aio.nx_buf;sec = yc_aio.nx_sec;num = yc_aio.nx_num;
+        yc_aio.nx_ready = 0;yc_aio.inflight = 1;
+        YC_FAT_AioSubmit(buf,sec,num);
+    }
 }
 
-/* 重命名目录,newdir路径可以是任意路径 */
-int YC_FAT_RenameDir(unsigned char *dir_path,unsigned char *newdir)
+/* 向设备提交一段传输，底层没有异步接口时退化为同步读写 */
+static void YC_FAT_AioSubmit(unsigned char *buf,unsigned int sec,unsigned int num)
 {
-    unsigned int dir_clu;
-    unsigned char len1,len2;
-    FILE1 file;
-	/* dir_path预处理 */
+    if(yc_aio.wr)
+    {
+        if((NULL != cur_ioopr) && (NULL != cur_ioopr->DeviceOpr_WR_Async))
+        {
+            if(0 != cur_ioopr->DeviceOpr_WR_Async(buf,sec,num,YC_FAT_AioCplt,NULL))
+                YC_FAT_AioCplt(NULL,1);/* 提交失败 */
+            return;
+        }
+        YC_FAT_DevWrite(buf,sec,num);
+    }
+    else
+    {
+        if((NULL != cur_ioopr) && (NULL != cur_ioopr->DeviceOpr_RD_Async))
+        {
+            if(0 != cur_ioopr->DeviceOpr_RD_Async(buf,sec,num,YC_FAT_AioCplt,NULL))
+                YC_FAT_AioCplt(NULL,1);/* 提交失败 */
+            return;
+        }
+        YC_FAT_DevRead(buf,sec,num);
+    }
+    YC_FAT_AioCplt(NULL,0);
+}
+
+/* 设备空闲且下一段已准备好时提交 */
+static void YC_FAT_AioKick(void)
+{
+    unsigned char go = 0;unsigned char *buf;unsigned int sec = 0,num = 0;
+    YC_FAT_ENTER_CRITICAL();
+    if(yc_aio.nx_ready && !yc_aio.inflight && !yc_aio.err)
+    {
+        buf = yc_aio.nx_buf;sec = yc_aio.nx_sec;num = yc_aio.nx_num;
+        yc_aio.nx_ready = 0;yc_aio.inflight = 1;go = 1;
+    }
+    YC_FAT_EXIT_CRITICAL();
+    if(go) YC_FAT_AioSubmit(buf,sec,num);
+}
+
+/* 发布已准备好的一段 */
+static void YC_FAT_AioPublish(unsigned int sec,unsigned int num)
+{
+    unsigned char *buf = yc_aio.buf+yc_aio.buf_off;
+    yc_aio.buf_off += num*PER_SECSIZE;
+    YC_FAT_ENTER_CRITICAL();
+    yc_aio.nx_buf = buf;yc_aio.nx_sec = sec;yc_aio.nx_num = num;
+    yc_aio.nx_ready = 1;
+    YC_FAT_EXIT_CRITICAL();
+}
+
+/* 准备下一段，写的段由写缓冲簇链直接给出，读的段需遍历FAT合并物理连续簇 */
+static void YC_FAT_AioPrepare(void)
+{
+    unsigned int next,n;
+    if(yc_aio.nx_ready || yc_aio.err) return;
+    if(yc_aio.wr)
+    {
+        if(!yc_aio.sec_left || (yc_aio.wpos == &yc_aio.file->WRCluChainList)) return;
+        n = (((w_buffer_t *)yc_aio.wpos)->w_e_clu-((w_buffer_t *)yc_aio.wpos)->w_s_clu+1)*g_dbr[0].secPerClus;
+        n = MIN(yc_aio.sec_left, n);
+        YC_FAT_AioPublish(START_SECTOR_OF_FILE(((w_buffer_t *)yc_aio.wpos)->w_s_clu),n);
+        yc_aio.sec_left -= n;
+        yc_aio.wpos = yc_aio.wpos->next;
+        return;
+    }
+    while(yc_aio.sec_left)
+    {
+        /* 需要读新的FAT扇区但设备正忙，等下次轮询再准备 */
+        if((CLU_TO_FATSEC(yc_aio.clu) != yc_aio.cached_sec) && yc_aio.inflight) return;
+        next = YC_TakefileNextClu_Cached(yc_aio.clu,&yc_aio.fat_sec,&yc_aio.cached_sec);
+        if(IS_EOF(next))
+        {
+            yc_aio.sec_left = 0;/* 簇链比文件大小短，读到簇链末尾为止 */
+            break;
+        }
+        n = MIN(yc_aio.sec_left, g_dbr[0].secPerClus);
+        if(next != (yc_aio.clu + 1))
+        {
+            /* 遇到不连续簇，发布当前段，新段从next开始 */
+            YC_FAT_AioPublish(yc_aio.bd_sec,yc_aio.bd_num);
+            yc_aio.bd_sec = START_SECTOR_OF_FILE(next);yc_aio.bd_num = n;
+            yc_aio.sec_left -= n;yc_aio.clu = next;
+            return;
+        }
+        yc_aio.bd_num += n;yc_aio.sec_left -= n;
+        yc_aio.clu = next;
+    }
+    if(yc_aio.bd_num)
+    {
+        YC_FAT_AioPublish(yc_aio.bd_sec,yc_aio.bd_num);
+        yc_aio.bd_num = 0;
+    }
+}
+
+/* 异步读写轮询，在主循环或空闲任务中调用，返回1表示请求仍在进行 */
+/* 所有段传输完成后在此完成收尾（写文件时缝合簇链、更新FDI和FSINFO）并调用用户回调 */
+int YC_FAT_AsyncPoll(void)
+{
+    int result;FILE1 *fl;struct list_head *pos,*tmp;
+    unsigned int minclu;
+#if YC_FAT_PREALLOC
+    unsigned int first,last;
+#endif
+    if(!yc_aio.busy) return 0;
+    YC_FAT_AioKick();
+    YC_FAT_AioPrepare();
+    YC_FAT_AioKick();
+    if(yc_aio.inflight) return 1;
+    if(!yc_aio.err && (yc_aio.sec_left || yc_aio.nx_ready || yc_aio.bd_num)) return 1;
+    /* 所有段传输完成（或出错后在途段已结束） */
+    fl = yc_aio.file;
+    if(yc_aio.err)
+    {
+        result = AIO_DEVICE_ERR;
+        if(yc_aio.wr)
+        {
+            /* 数据未完整写入，不缝合簇链，文件保持原状 */
+#if YC_FAT_PREALLOC
+            /* 取用的预分配簇仍链接在文件尾簇之后，放回预分配 */
+            if(fl->PreTaken)
+            {
+                first = ((w_buffer_t *)fl->WRCluChainList.next)->w_s_clu;
+                last = YC_FAT_DropPrealloc(fl,fl->PreTaken);
+                if(!fl->PreNum) fl->PreEnd = last;
+                fl->PreClu = first;
+                fl->PreNum += fl->PreTaken;
+                fl->PreTaken = 0;
+            }
+#endif
+            /* 其余为新分配的簇，FAT未写入，与分配失败时一样还原分配位置并重新映射位图 */
+            minclu = FatInitArgs_a[0].NextFreeClu;
+            list_for_each_safe(pos, tmp, &fl->WRCluChainList)
+            {
+                if(((w_buffer_t *)pos)->w_s_clu < minclu)
+                    minclu = ((w_buffer_t *)pos)->w_s_clu;
+                list_del(pos);
+                tFreeHeapforeach((void *)pos);
+            }
+            INIT_LIST_HEAD(&fl->WRCluChainList);
+            FatInitArgs_a[0].NextFreeClu = minclu;
+            cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
+            YC_FAT_RemapToBit(cur_fat_sec);
+            /* 新文件还原首簇和尾簇 */
+            if(0 == fl->fl_sz)
+            {
+                fl->CurClus_R = fl->FirstClu = yc_aio.bk_first;
+                fl->EndClu = yc_aio.bk_end;
+            }
+        }
+    }
+    else
+    {
+        result = yc_aio.t_size;
+        if(yc_aio.wr)
+        {
+            YC_FAT_WriteFinish(fl,yc_aio.t_size,yc_aio.to_alloc_num);
+            YC_FAT_Commit();
+        }
+        else
+        {
+            /* 刷新读锚定 */
+            fl->left_sz -= yc_aio.t_size;
+            YC_FAT_SetReadAnchor(fl,yc_aio.clu);
+        }
+    }
+    yc_aio.busy = 0;
+    if(NULL != yc_aio.cb) yc_aio.cb(fl,result,yc_aio.arg);
+    return 0;
+}
+
+/* 等待异步请求完成 */
+void YC_FAT_AsyncWait(void)
+{
+    while(YC_FAT_AsyncPoll());
+}
+
+/* 异步读文件，当前读偏移和len必须扇区对齐，提交后立即返回 */
+int YC_FAT_ReadAsync(FILE1* fileInfo,unsigned char * d_buf,unsigned int len,yc_aio_cb_t cb,void *arg)
+{
+    unsigned int off_sec,t_rSize;
+    if((NULL == fileInfo) || (FILE_OPEN != fileInfo->file_state)) return -1;
+    if(yc_aio.busy) return AIO_BUSY_ERR;
+#if YC_FAT_DELALLOC
+    if(fileInfo->da_len)
+    {
+        YC_FAT_DelallocFlush(fileInfo);
+        YC_FAT_Commit();
+    }
+#endif
+    if(((fileInfo->fl_sz - fileInfo->left_sz)%PER_SECSIZE) || (len%PER_SECSIZE))
+        return DIRECT_IO_ALIGN_ERR;
+    t_rSize = MIN(len, fileInfo->left_sz);
+    YC_Memset(&yc_aio,0,sizeof(yc_aio));
+    yc_aio.file = fileInfo;yc_aio.buf = d_buf;yc_aio.t_size = t_rSize;
+    yc_aio.cb = cb;yc_aio.arg = arg;yc_aio.busy = 1;
+    yc_aio.clu = fileInfo->CurClus_R;
+    if(t_rSize)
+    {
+        yc_aio.sec_left = t_rSize/PER_SECSIZE;
+        if(t_rSize%PER_SECSIZE) yc_aio.sec_left++;
+        /* 锚定起始簇和簇内扇区偏移 */
+        off_sec = YC_FAT_ReadCluOff(fileInfo)/PER_SECSIZE;
+        if(off_sec == g_dbr[0].secPerClus)
+        {
+            yc_aio.clu = YC_TakefileNextClu_Cached(yc_aio.clu,&yc_aio.fat_sec,&yc_aio.cached_sec);
+            off_sec = 0;
+        }
+        yc_aio.bd_sec = START_SECTOR_OF_FILE(yc_aio.clu)+off_sec;
+        yc_aio.bd_num = MIN(yc_aio.sec_left, g_dbr[0].secPerClus-off_sec);
+        yc_aio.sec_left -= yc_aio.bd_num;
+    }
+    YC_FAT_AsyncPoll();
+    return 0;
+}
+
+/* 异步写文件，在文件末尾追加数据，文件大小和len必须扇区对齐，提交后立即返回 */
+/* 簇链在提交前一次性分配，数据全部落盘后才在YC_FAT_AsyncPoll中缝合簇链 */
+int YC_FAT_WriteAsync(FILE1* fileInfo,unsigned char * d_buf,unsigned int len,yc_aio_cb_t cb,void *arg)
+{
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int n;int to_alloc_num = 0;
+    if(NULL == fileInfo)
+        return WRITE_FILE_PARAM_ERR;
+    if(FILE_OPEN != fileInfo->file_state)
+        return WRITE_FILE_CLOSED_ERR;
+    if(0 == len)
+        return WRITE_FILE_LENGTH_WARN;
+#if YC_FILE2MEM
+    if(NULL != fileInfo->mem)
+        return WRITE_FILE_MEM_ERR;
+#endif
+    if(yc_aio.busy) return AIO_BUSY_ERR;
+    if((fileInfo->fl_sz%PER_SECSIZE) || (len%PER_SECSIZE))
+        return DIRECT_IO_ALIGN_ERR;
+    if((len + fileInfo->fl_sz) < fileInfo->fl_sz)
+        return WRITE_FILE_PARAM_ERR;
+    /* 预生成文件簇链 */
+    if(len > fileInfo->EndCluLeftSize)
+    {
+        to_alloc_num = (len - fileInfo->EndCluLeftSize)/clu_size;
+        if((len - fileInfo->EndCluLeftSize)%clu_size) to_alloc_num++;
+        if(0 > YC_FAT_CreateFileCluChain(fileInfo,to_alloc_num))
+            return -1;/* 簇链分配失败 */
+    }
+    YC_Memset(&yc_aio,0,sizeof(yc_aio));
+    yc_aio.file = fileInfo;yc_aio.buf = d_buf;yc_aio.t_size = len;
+    yc_aio.wr = 1;yc_aio.to_alloc_num = to_alloc_num;
+    yc_aio.bk_first = fileInfo->FirstClu;yc_aio.bk_end = fileInfo->EndClu;
+    yc_aio.cb = cb;yc_aio.arg = arg;yc_aio.busy = 1;
+    yc_aio.sec_left = len/PER_SECSIZE;
+    yc_aio.wpos = fileInfo->WRCluChainList.next;
+    if(0 == fileInfo->fl_sz)/* 新文件 */
+    {
+        fileInfo->CurClus_R = fileInfo->FirstClu = \
+        fileInfo->EndClu = ((w_buffer_t *)fileInfo->WRCluChainList.next)->w_s_clu;
+    }
+    else if(fileInfo->EndCluLeftSize)
+    {
+        /* 第一段为尾簇剩余扇区 */
+        n = MIN(len, fileInfo->EndCluLeftSize)/PER_SECSIZE;
+        YC_FAT_AioPublish(START_SECTOR_OF_FILE(fileInfo->EndClu)+(clu_size-fileInfo->EndCluLeftSize)/PER_SECSIZE,n);
+        yc_aio.sec_left -= n;
+    }
+    YC_FAT_AsyncPoll();
+    return 0;
+}
+#endif
+
+/* 查找文件，返回文件对象 */
+static SeekFile YC_FAT_SeekFDI(unsigned char * filepath,FILE1 * file,FDI_t *fdi_out)
+{
+    unsigned char fp[50];
+    unsigned int file_clu = 0;
+	unsigned char len1,len2;
+    DelexcSpace(filepath,fp);
+	len1 =  YC_StrLen(fp);
+    unsigned char f_n[50] = {0};
+    if(!YC_FAT_TakeFN(fp,f_n)) return NOTFOUND;
+	len2 =  YC_StrLen(f_n);
+    unsigned char f_p[50] = {0};
+	if(len1-len2) YC_StrCpy_l(f_p,fp,len1-len2);
+    if(!IS_FILENAME_ILLEGAL(f_n)) return NOTFOUND;
+    /* 进入文件目录，这里假设是标准绝对路径寻找文件 */
+    file_clu = YC_FAT_EnterDir(f_p);
+    if((int)file_clu < 0) return NOTFOUND;/* 目录不存在，错误码不能当作簇号 */
+    return YC_FAT_MatchFDI(file_clu,file,f_n,fdi_out);
+}
+
+static FILE1 YC_FAT_SeekFile(unsigned char * filepath)
+{
+    FILE1 file = {0};
+    YC_FAT_SeekFDI(filepath,&file,NULL);
+    return file;
+}
+
+#if YC_FAT_STAT
+/* 文件日期时间 */
+typedef struct {
+    unsigned short yy;
+    unsigned char mm,dd;
+    unsigned char hour,min,sec;
+}yc_ftime_t;
+
+/* 文件信息 */
+typedef struct {
+    unsigned int size;          /* 文件大小（字节） */
+    unsigned int first_clu;     /* 首簇，空文件为0 */
+    unsigned char attr;         /* 属性，TP_DIR表示目录 */
+    yc_ftime_t crt;             /* 创建时间 */
+    yc_ftime_t mod;             /* 最近修改时间 */
+    yc_ftime_t acs;             /* 最近访问日期，时分秒为0 */
+}yc_stat_t;
+/* 文件信息查询错误码 */
+#define STAT_PARAM_ERR -1
+#define STAT_NOT_FOUND_ERR -2
+
+/* 解析目录项中的日期和时间 */
+static void YC_FAT_DecodeTime(unsigned short d,unsigned short t,yc_ftime_t *ft)
+{
+    ft->yy = DATE_YY_BASE + ((MASK_DATE_YY & d) >> 9);
+    ft->mm = (MASK_DATE_MM & d) >> 5;
+    ft->dd = MASK_DATE_DD & d;
+    ft->hour = (MASK_TIME_HOUR & t) >> 11;
+    ft->min = (MASK_TIME_MIN & t) >> 5;
+    ft->sec = 2 * (MASK_TIME_SEC & t);
+}
+
+/* 查询文件信息，不打开文件、不占用打开文件表、不访问簇链，只扫描路径上的目录项 */
+int YC_FAT_Stat(unsigned char *filepath,yc_stat_t *info)
+{
+    FILE1 file = {0};
+    FDI_t fdi;
+    if((NULL == filepath) || (NULL == info)) return STAT_PARAM_ERR;
+    if(FOUND != YC_FAT_SeekFDI(filepath,&file,&fdi)) return STAT_NOT_FOUND_ERR;
+    info->size = file.fl_sz;
+    info->first_clu = file.FirstClu;
+    info->attr = fdi.attribute;
+    YC_FAT_DecodeTime(Byte2Value((unsigned char *)&fdi.crtDate,2),Byte2Value((unsigned char *)&fdi.crtTime,2),&info->crt);
+    YC_FAT_DecodeTime(Byte2Value(fdi.modDate,2),Byte2Value(fdi.modTime,2),&info->mod);
+    YC_FAT_DecodeTime(Byte2Value((unsigned char *)&fdi.acsDate,2),0,&info->acs);
+    return 0;
+}
+
+/* 文件或目录是否存在 */
+int YC_FAT_Exists(unsigned char *filepath)
+{
+    FILE1 file = {0};
+    if(NULL == filepath) return 0;
+    return (FOUND == YC_FAT_SeekFDI(filepath,&file,NULL)) ? 1 : 0;
+}
+#endif
+
+/* 销毁簇链 */
+#if YC_FAT_DISCARD
+/* 待擦除区间（簇号），物理相邻的释放簇合并为一个区间 */
+static unsigned int disc_s[DISCARD_RANGES],disc_e[DISCARD_RANGES];
+static unsigned char disc_n = 0;
+#if YC_FAT_DISCARD == DISCARD_BATCHED
+static unsigned char disc_hold = 0;/* 非0时YC_FAT_FreeChain不下发，由YC_FAT_Sync统一下发 */
+#endif
+
+/* 将待擦除区间通过usr_clear下发给设备（SD/eMMC的擦除或TRIM） */
+/* 必须在FAT释放写入设备之后调用，掉电时不会出现FAT仍引用已擦除簇的情况 */
+static void YC_FAT_DiscardFlush(void)
+{
+    unsigned char i;
+    for(i = 0;i < disc_n;i++)
+        usr_clear(START_SECTOR_OF_FILE(disc_s[i]),(disc_e[i]-disc_s[i]+1)*g_dbr[0].secPerClus);
+    disc_n = 0;
+}
+
+/* 记录一个释放的簇，与最近的区间相邻时合并，区间表满时不再记录（擦除只是提示，少擦不影响正确性） */
+static void YC_FAT_DiscardAdd(unsigned int clu)
+{
+    if(disc_n)
+    {
+        if(disc_e[disc_n-1]+1 == clu)
+        {
+            disc_e[disc_n-1] = clu;
+            return;
+        }
+        if(disc_s[disc_n-1] == clu+1)
+        {
+            disc_s[disc_n-1] = clu;
+            return;
+        }
+    }
+    if(DISCARD_RANGES == disc_n) return;
+    disc_s[disc_n] = disc_e[disc_n] = clu;
+    disc_n++;
+}
+#endif
+
+/* 返回释放的簇数，minclu返回释放的最小簇号，discard为0时不记录擦除区间 */
+static unsigned int YC_FAT_DestroyCluChain(unsigned int bootclu,unsigned int *minclu,unsigned char discard)
+{
+	/* 销毁簇链 */
+    unsigned int clu = bootclu;
+	unsigned int bk1,bk2,bk3;
+	unsigned int freed = 0;
+    unsigned int *p = NULL;unsigned int *this = NULL;
+    unsigned short off_fat = ((clu * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;/* 计算在FAT中的偏移（以FAT大小为单位） */
+    do
+    {
+		unsigned int h_clu = clu-off_fat;//当前FAT表内约束1
+		unsigned int t_clu = h_clu+(PER_SECSIZE/FAT_SIZE)-1;//当前FAT表内约束2
+        this = p = (unsigned int *)buffer3 + off_fat;
+		/* 读出段簇所在扇区数据 */
+		YC_FAT_DevRead(buffer3,CLU_TO_FATSEC(clu),1);
+        bk1 = bk2 = *(unsigned int*)this;
+		bk3 = clu;
+		*this = 0;
+        for(;;)
+        {
+            *this = 0;
+            freed++;
+            if(bk3 < *minclu) *minclu = bk3;
+#if YC_FAT_DISCARD
+            if(discard) YC_FAT_DiscardAdd(bk3);
+#else
+            (void)discard;
+#endif
+			/* 在当前FAT扇区内逐个遍历，碰到段尾簇就寻找下一个段簇，继续读出下一段簇所在FAT扇区 */
+            if( (bk1 > t_clu) || (bk1 < h_clu) )
+            {
+				YC_FAT_QueueWrite(buffer3,CLU_TO_FATSEC(clu));
+                clu = bk2;
+                break;
+            }
+			bk3 = bk1 = bk2;
+			p = ((unsigned int *)buffer3+TAKE_FAT_OFF(bk2));
+			this = p;bk1 = bk2 = *p;
+        }
+		off_fat = (((unsigned int)(clu) * FAT_SIZE) % PER_SECSIZE)/FAT_SIZE;
+    }while(!IS_EOF(clu));
+#if YC_FAT_DEBUG
+	printf("deleted file tail clu is%d\r\n",bk3);
+#endif
+    return freed;
+}
+
+/* 释放簇链，同时更新空闲簇数目、FSINFO和下一空闲簇，discard为0时不擦除（簇从未写入过数据） */
+static void YC_FAT_ReleaseChain(unsigned int bootclu,unsigned char discard)
+{
+    unsigned int minclu = 0xffffffff;
+    FatInitArgs_a[0].FreeClusNum += YC_FAT_DestroyCluChain(bootclu,&minclu,discard);
+    YC_FAT_UpdateFSInfo();
+    YC_FAT_Commit();
+#if YC_FAT_DISCARD
+    /* 擦除必须在簇重新可分配之前下发，之后簇可能已被复用 */
+#if YC_FAT_DISCARD == DISCARD_BATCHED
+    if(!disc_hold)
+#endif
+    {
+#if YC_FAT_WRQUEUE
+        if(batch_depth) disc_n = 0;/* 批量事务中FAT释放还未写入设备，放弃擦除 */
+#endif
+        YC_FAT_DiscardFlush();
+    }
+#endif
+    /* 释放的簇比当前分配位置靠前时，分配位置回退，让空间优先从磁盘前部复用 */
+    if((FatInitArgs_a[0].NextFreeClu == 0) || (FatInitArgs_a[0].NextFreeClu == 0xffffffff) || \
+        (minclu < FatInitArgs_a[0].NextFreeClu))
+        FatInitArgs_a[0].NextFreeClu = minclu;
+    /* 重新映射位图，FAT扇区从写队列中读出，位图与刚释放的簇一致 */
+    cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
+    YC_FAT_RemapToBit(cur_fat_sec);
+}
+
+/* 释放簇链并擦除 */
+static void YC_FAT_FreeChain(unsigned int bootclu)
+{
+    YC_FAT_ReleaseChain(bootclu,1);
+}
+
+#if YC_FAT_DEFER_FREE
+/* 延后回收队列，存放已删除文件的首簇，先进先回收 */
+static unsigned int dfree_q[DEFER_FREE_NUM];
+static unsigned char dfree_n = 0;
+
+/* 空闲处理，回收一条延后释放的簇链，返回队列中剩余的簇链数 */
+/* 建议在系统空闲时循环调用，直到返回0 */
+int YC_FAT_Idle(void)
+{
+    unsigned int bootclu;
+    unsigned char i;
+    if(!dfree_n) return 0;
+    bootclu = dfree_q[0];
+    for(i = 1;i < dfree_n;i++) dfree_q[i-1] = dfree_q[i];
+    dfree_n--;
+    YC_FAT_FreeChain(bootclu);
+    return dfree_n;
+}
+
+/* 簇链加入延后回收队列，队列满时先回收最早的一条 */
+static void YC_FAT_DeferFree(unsigned int bootclu)
+{
+    if(DEFER_FREE_NUM == dfree_n)
+        YC_FAT_Idle();
+    dfree_q[dfree_n++] = bootclu;
+}
+#endif
+
+/* 同步，回收所有延后释放的簇链，并将写队列中的元数据全部下发至设备 */
+void YC_FAT_Sync(void)
+{
+#if YC_FAT_DISCARD == DISCARD_BATCHED
+    disc_hold = 1;/* 回收过程中不分配簇，擦除区间合并到最后一次下发 */
+#endif
+#if YC_FAT_DEFER_FREE
+    while(YC_FAT_Idle());
+#endif
+#if YC_FAT_WRQUEUE
+    YC_FAT_FlushQueue();/* 批量事务中同样立即下发 */
+#endif
+#if YC_FAT_DISCARD == DISCARD_BATCHED
+    YC_FAT_DiscardFlush();
+    disc_hold = 0;
+#endif
+}
+
+#if YC_FAT_CHECK
+/* 磁盘检查结果 */
+typedef struct {
+    unsigned int files;         /* 文件数 */
+    unsigned int dirs;          /* 目录数（不含根目录） */
+    unsigned int used_clus;     /* 文件和目录占用的簇数 */
+    unsigned int free_clus;     /* FAT中的空闲簇数（修复后） */
+    unsigned int lost_clus;     /* 丢失簇数，FAT中已占用但不属于任何文件或目录 */
+    unsigned int cross_links;   /* 交叉链接数，同一簇被多条簇链引用 */
+    unsigned int bad_chains;    /* 含非法簇号的簇链数 */
+    unsigned int size_mismatch; /* 簇链长度与文件大小不符的文件数（修复时只截短超出簇链的文件大小） */
+    unsigned int fsinfo_free;   /* FSINFO中记录的空闲簇数 */
+    unsigned char too_deep;     /* 目录层数超过CHECK_MAX_DEPTH而跳过的目录数 */
+}yc_check_t;
+/* 磁盘检查错误码 */
+#define CHECK_WORK_SIZE_ERR -1
+#define CHECK_BUSY_ERR -2 /* 修复时有文件打开或异步请求未完成 */
+
+#define CHK_BIT(b,c) ((b)[(c)>>3] & (1<<((c)&7)))
+#define CHK_SET(b,c) ((b)[(c)>>3] |= (1<<((c)&7)))
+
+/* 沿簇链在归属位图中标记簇，返回新标记的簇数 */
+/* 遇到已被其他簇链占用的簇（交叉链接）或非法簇号时在前一簇处截断（repair时） */
+/* 首簇即非法或已被占用时返回0，没有前一簇可截断，由调用者修正目录项 */
+static unsigned int YC_FAT_CheckChain(unsigned int clu,unsigned char *bmp,unsigned char repair,yc_check_t *rep)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int prev = 0,n = 0,end = CLU_END();
+    for(;;)
+    {
+        if((clu < 2) || (clu >= end))
+        {
+            rep->bad_chains++;
+            if(repair && prev) YC_FAT_ExpandCluChain(prev,0x0fffffff);
+            break;
+        }
+        if(CHK_BIT(bmp,clu))
+        {
+            rep->cross_links++;
+            if(repair && prev) YC_FAT_ExpandCluChain(prev,0x0fffffff);
+            break;
+        }
+        CHK_SET(bmp,clu);n++;
+        prev = clu;
+        clu = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if(clu >= 0x0ffffff8) break;/* 簇链结束 */
+    }
+    return n;
+}
+
+/* 磁盘检查，从根目录遍历所有目录项，按簇链建立簇归属位图，再分块顺序读FAT比对 */
+/* work由调用者提供，前(CLU_END()+7)/8字节为归属位图，其余作为FAT分块读缓冲区（至少一个扇区） */
+/* repair为1时释放丢失簇、截断交叉链接和非法簇链、修正FSINFO中的空闲簇数，须先关闭所有文件 */
+/* 返回0表示无错误，1表示发现错误（repair时已修复），负数为错误码 */
+int YC_FAT_Check(void *work,unsigned int work_sz,unsigned char repair,yc_check_t *rep)
+{
+    struct {
+        unsigned int clu;       /* 目录当前簇 */
+        unsigned char sec;      /* 簇内扇区 */
+        unsigned short ent;     /* 扇区内目录项 */
+    }stk[CHECK_MAX_DEPTH];
+    FDIs_t fdis;FDI_t *fdi;
+    unsigned char *bmp = (unsigned char *)work,*chunk;
+    unsigned int end = CLU_END(),bmp_sz = (end+7)/8;
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int chunk_secs,sec,n,i,clu,v,fl_sz,hint;
+    int d = 0;
+    if((NULL == work) || (NULL == rep) || (work_sz < bmp_sz+PER_SECSIZE))
+        return CHECK_WORK_SIZE_ERR;
+    /* 修复会改写FAT和目录项，不能与打开的句柄或在途的异步请求同时进行 */
+    if(repair)
+    {
+#if MAX_OPEN_FILES
+        for(i = 0;i < OPEN_HASH_SIZE;i++)
+            if(open_hash[i]) return CHECK_BUSY_ERR;
+#endif
+#if YC_FAT_ASYNC_IO
+        if(yc_aio.busy) return CHECK_BUSY_ERR;
+#endif
+    }
+    chunk = bmp+bmp_sz;
+    chunk_secs = (work_sz-bmp_sz)/PER_SECSIZE;
+    YC_Memset(bmp,0,bmp_sz);
+    YC_Memset(rep,0,sizeof(yc_check_t));
+    /* 先回收延后释放的簇链，下发所有元数据 */
+    YC_FAT_Sync();
+
+    /* 遍历目录树，标记所有文件和目录的簇链 */
+    rep->used_clus = YC_FAT_CheckChain(ROOT_CLUS,bmp,repair,rep);
+    stk[0].clu = ROOT_CLUS;stk[0].sec = 0;stk[0].ent = 0;
+    while(d >= 0)
+    {
+        YC_FAT_DevRead((unsigned char *)&fdis,START_SECTOR_OF_FILE(stk[d].clu)+stk[d].sec,1);
+        for(i = stk[d].ent;i < PER_SECSIZE/sizeof(FDI_t);i++)
+        {
+            fdi = &fdis.fdi[i];
+            if(0x00 == fdi->fileName[0]) break;/* 目录结束 */
+            if((0xE5 == fdi->fileName[0]) || ('.' == fdi->fileName[0])) continue;
+            if((0x0F == fdi->attribute) || (fdi->attribute & VOLUME)) continue;/* 长文件名和卷标 */
+            clu = Byte2Value((unsigned char *)&fdi->startClusLower,2) | (Byte2Value((unsigned char *)&fdi->startClusUper,2) << 16);
+            if(fdi->attribute & TP_DIR)
+            {
+                rep->dirs++;
+                n = YC_FAT_CheckChain(clu,bmp,repair,rep);
+                rep->used_clus += n;
+                if(!n)
+                {
+                    /* 首簇非法或已被占用，不再进入，避免目录成环；修复时删除该目录项 */
+                    if(repair)
+                    {
+                        fdi->fileName[0] = 0xE5;
+                        YC_FAT_QueueWrite((unsigned char *)&fdis,START_SECTOR_OF_FILE(stk[d].clu)+stk[d].sec);
+                    }
+                    continue;
+                }
+                if(CHECK_MAX_DEPTH-1 == d)
+                {
+                    rep->too_deep++;
+                    continue;
+                }
+                stk[d].ent = i+1;/* 返回时从下一目录项继续 */
+                d++;
+                stk[d].clu = clu;stk[d].sec = 0;stk[d].ent = 0;
+                break;
+            }
+            rep->files++;
+            fl_sz = Byte2Value((unsigned char *)&fdi->fileSize,4);
+            n = clu ? YC_FAT_CheckChain(clu,bmp,repair,rep) : 0;
+            rep->used_clus += n;
+            if(n != (fl_sz+clu_size-1)/clu_size) rep->size_mismatch++;
+            /* 修复时文件大小截到剩余簇链长度，首簇非法或已被占用时清除首簇成为空文件 */
+            if(repair && ((fl_sz > n*clu_size) || (clu && !n)))
+            {
+                if(!n)
+                {
+                    *(J_UINT16 *)fdi->startClusUper = 0;
+                    *(J_UINT16 *)fdi->startClusLower = 0;
+                }
+                fl_sz = MIN(fl_sz,n*clu_size);
+                Value2Byte4(&fl_sz,(unsigned char *)&fdi->fileSize);
+                YC_FAT_QueueWrite((unsigned char *)&fdis,START_SECTOR_OF_FILE(stk[d].clu)+stk[d].sec);
+            }
+        }
+        if(i < PER_SECSIZE/sizeof(FDI_t))
+        {
+            if(0x00 == fdis.fdi[i].fileName[0]) d--;/* 本目录扫描完毕 */
+            continue;/* 进入了子目录 */
+        }
+        /* 下一扇区，本簇扫描完时沿簇链前进 */
+        stk[d].ent = 0;
+        if(++stk[d].sec == g_dbr[0].secPerClus)
+        {
+            stk[d].sec = 0;
+            v = YC_TakefileNextClu(stk[d].clu) & 0x0fffffff;
+            if((v < 2) || (v >= end)) d--;
+            else stk[d].clu = v;
+        }
+    }
+
+    /* 分块顺序读FAT，统计空闲簇，找出丢失簇 */
+    for(sec = 0;sec < g_dbr[0].FATSz32;sec += n)
+    {
+        n = MIN(chunk_secs,g_dbr[0].FATSz32-sec);
+        YC_FAT_DevRead(chunk,FatInitArgs_a[0].FAT1Sec+sec,n);
+        for(i = 0;i < n*(PER_SECSIZE/FAT_SIZE);i++)
+        {
+            clu = sec*(PER_SECSIZE/FAT_SIZE)+i;
+            if(clu < 2) continue;
+            if(clu >= end) break;
+            v = Byte2Value(chunk+i*FAT_SIZE,FAT_SIZE) & 0x0fffffff;
+            if(0 == v) rep->free_clus++;
+            else if((0x0ffffff7 != v) && !CHK_BIT(bmp,clu))/* 坏簇标记不算丢失 */
+            {
+                rep->lost_clus++;
+                if(repair)
+                {
+                    YC_FAT_ExpandCluChain(clu,0);
+                    rep->free_clus++;
+                }
+            }
+        }
+    }
+
+    /* 核对FSINFO中的空闲簇数 */
+    YC_FAT_ReadInfoSec(&rep->fsinfo_free,&hint);
+    if(repair)
+    {
+        FatInitArgs_a[0].FreeClusNum = rep->free_clus;
+        /* 分配位置回到第一个空闲簇 */
+        if(0 == YC_FAT_SeekFirstEmptyClus((unsigned int *)&FatInitArgs_a[0].NextFreeClu))
+        {
+            cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
+            YC_FAT_RemapToBit(cur_fat_sec);
+        }
+        YC_FAT_UpdateFSInfo();
+        YC_FAT_Commit();
+    }
+    if(rep->lost_clus || rep->cross_links || rep->bad_chains || rep->size_mismatch || \
+        rep->too_deep || (rep->fsinfo_free != rep->free_clus))
+        return 1;
+    return 0;
+}
+#endif
+
+#if YC_FAT_DEFRAG || YC_FAT_PREALLOC
+/* 从簇2开始顺序扫描FAT中的空闲区间 */
+/* need非0时返回第一个长度不小于need的区间首簇（首次适配），找不到返回0 */
+/* hist非NULL时统计区间长度直方图，第i格为长度在[2^i,2^(i+1))的区间数，最后一格包含更长的区间 */
+static unsigned int YC_FAT_ScanFreeExtents(unsigned int need,unsigned int *hist,unsigned char bins,unsigned int *extents)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu,run_s = 0,len,end = CLU_END();
+    unsigned char b;
+    for(clu = 2;clu <= end;clu++)
+    {
+        if((clu < end) && (0 == (YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff)))
+        {
+            if(!run_s) run_s = clu;
+            if(need && (clu-run_s+1 >= need)) return run_s;
+            continue;
+        }
+        if(!run_s) continue;
+        /* 一个空闲区间结束 */
+        len = clu-run_s;
+        run_s = 0;
+        if(extents) (*extents)++;
+        if(hist && bins)
+        {
+            for(b = 0;(b < bins-1) && (len >> (b+1));b++);
+            hist[b]++;
+        }
+    }
+    return 0;
+}
+
+/* 占用[start,start+n)：链接为一条簇链，FAT扇区经写队列批量写入，同时更新空闲簇数和分配位置 */
+static void YC_FAT_ClaimExtent(unsigned int start,unsigned int n)
+{
+    FAT32_Sec_t fat_sec;
+    unsigned int c,v,sec = 0,fsec;
+    for(c = start;c < start+n;c++)
+    {
+        fsec = CLU_TO_FATSEC(c);
+        if(fsec != sec)
+        {
+            if(sec) YC_FAT_QueueWrite((unsigned char *)&fat_sec,sec);
+            sec = fsec;
+            YC_FAT_DevRead((unsigned char *)&fat_sec,sec,1);
+        }
+        v = (c == start+n-1) ? 0x0fffffff : c+1;
+        Value2Byte4(&v,(unsigned char *)&fat_sec.fat_sec[TAKE_FAT_OFF(c)]);
+    }
+    if(sec) YC_FAT_QueueWrite((unsigned char *)&fat_sec,sec);
+    FatInitArgs_a[0].FreeClusNum -= n;
+    YC_FAT_UpdateFSInfo();
+    /* 分配位置落在区间内时移到区间之后 */
+    if((FatInitArgs_a[0].NextFreeClu >= start) && (FatInitArgs_a[0].NextFreeClu < start+n))
+        YC_FAT_SeekNextFirstEmptyClu(start+n-1,(unsigned int *)&FatInitArgs_a[0].NextFreeClu);
+    cur_fat_sec = CLU_TO_FATSEC(FatInitArgs_a[0].NextFreeClu);
+    YC_FAT_RemapToBit(cur_fat_sec);
+}
+#endif
+
+#if YC_FAT_DEFRAG
+/* 碎片整理上下文，由调用者分配，YC_FAT_DefragBegin初始化后逐次传给YC_FAT_DefragStep */
+typedef struct {
+    unsigned int fdi_sec;       /* 文件FDI所在扇区 */
+    unsigned short fdi_off;     /* 文件FDI扇区内偏移 */
+    unsigned int old_clu;       /* 原首簇 */
+    unsigned int fl_sz;         /* 开始整理时的文件大小 */
+    unsigned int gen;           /* 开始整理时的修改代号 */
+    unsigned int dst;           /* 目标连续区间首簇 */
+    unsigned int nclus;         /* 文件簇数 */
+    unsigned int done;          /* 已迁移簇数 */
+    unsigned int src;           /* 下一待迁移的源簇 */
+    unsigned char *buf;         /* 数据搬运缓冲区 */
+    unsigned int buf_secs;      /* 缓冲区扇区数 */
+}yc_defrag_t;
+/* 碎片整理错误码 */
+#define DEFRAG_PARAM_ERR -1
+#define DEFRAG_OPENED_ERR -2     /* 文件已打开，稍后重试 */
+#define DEFRAG_NO_EXTENT_ERR -3  /* 没有足够大的连续空闲区间 */
+#define DEFRAG_CHANGED_ERR -4    /* 整理期间文件被修改，已放弃 */
+#define DEFRAG_CHAIN_ERR -5      /* 簇链含非法簇号 */
+
+/* 统计簇链的簇数和连续段数，簇链含非法簇号时返回-1 */
+static int YC_FAT_ChainRuns(unsigned int clu,unsigned int *nclus)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int nxt,n = 0,end = CLU_END();
+    int runs = 0;
+    if(!clu)
+    {
+        *nclus = 0;
+        return 0;
+    }
+    runs = 1;
+    for(;;)
+    {
+        if((clu < 2) || (clu >= end) || (n >= end)) return -1;/* n超过总簇数说明簇链成环 */
+        n++;
+        nxt = YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff;
+        if(nxt >= 0x0ffffff8) break;
+        if(nxt != clu+1) runs++;
+        clu = nxt;
+    }
+    *nclus = n;
+    return runs;
+}
+
+/* 碎片报告：返回文件簇链的连续段数，1表示文件完全连续，空文件返回0，负数为错误码 */
+int YC_FAT_FileRuns(unsigned char *filepath)
+{
+    unsigned int n;int runs;
+    if(NULL == filepath) return DEFRAG_PARAM_ERR;
+    FILE1 file = YC_FAT_SeekFile(filepath);
+    if(0 == file.fdi_info_t.fdi_sec) return DEFRAG_PARAM_ERR;
+    runs = YC_FAT_ChainRuns(file.FirstClu,&n);
+    return (runs < 0) ? DEFRAG_CHAIN_ERR : runs;
+}
+
+/* 碎片报告：空闲区间长度直方图，hist[0..bins-1]由本函数清零后累加，返回空闲区间总数 */
+/* 第i格为长度在[2^i,2^(i+1))簇的区间数，最后一格包含所有更长的区间 */
+int YC_FAT_FreeExtentHist(unsigned int *hist,unsigned char bins)
+{
+    unsigned int extents = 0;
+    if((NULL == hist) || !bins) return DEFRAG_PARAM_ERR;
+    YC_Memset(hist,0,bins*sizeof(unsigned int));
+    YC_FAT_ScanFreeExtents(0,hist,bins,&extents);
+    return extents;
+}
+
+/* 放弃碎片整理，释放已分配的目标区间，文件保持原簇链不变 */
+void YC_FAT_DefragAbort(yc_defrag_t *ctx)
+{
+    if((NULL == ctx) || !ctx->dst) return;
+    YC_FAT_FreeChain(ctx->dst);
+    ctx->dst = 0;
+}
+
+/* 核对文件是否被打开或修改（含大小和首簇不变的原地覆盖写），修改时放弃整理并释放目标区间 */
+static int YC_FAT_DefragVerify(yc_defrag_t *ctx)
+{
+    unsigned int clu;
+#if MAX_OPEN_FILES
+    if(NULL != YC_FAT_OpenTabFind(ctx->fdi_sec,ctx->fdi_off))
+        return DEFRAG_OPENED_ERR;
+#endif
+    YC_FAT_DevRead(buffer1,ctx->fdi_sec,1);
+    clu = Byte2Value(buffer1+ctx->fdi_off+26,2) | (Byte2Value(buffer1+ctx->fdi_off+20,2) << 16);
+    if((0xE5 == buffer1[ctx->fdi_off]) || (clu != ctx->old_clu) || \
+        (Byte2Value(buffer1+ctx->fdi_off+28,4) != ctx->fl_sz) || \
+        YC_FAT_ModifiedSince(ctx->fdi_sec,ctx->fdi_off,ctx->gen))
+    {
+        YC_FAT_DefragAbort(ctx);
+        return DEFRAG_CHANGED_ERR;
+    }
+    return 0;
+}
+
+/* 开始整理一个文件：统计簇链，寻找一段能容纳整个文件的连续空闲区间并立即占用 */
+/* buf/buf_sz为调用者提供的搬运缓冲区（至少一个扇区，DMA传输时注意对齐），整理完成前不能释放 */
+/* 返回1表示已开始，0表示文件为空或已经连续无需整理，负数为错误码 */
+/* 目标区间在FAT中先链接好但不被任何目录项引用，掉电后成为丢失簇，可由YC_FAT_Check回收 */
+int YC_FAT_DefragBegin(yc_defrag_t *ctx,unsigned char *filepath,void *buf,unsigned int buf_sz)
+{
+    unsigned int n;int runs;
+    if((NULL == ctx) || (NULL == filepath) || (NULL == buf) || (buf_sz < PER_SECSIZE))
+        return DEFRAG_PARAM_ERR;
+    YC_Memset(ctx,0,sizeof(yc_defrag_t));
+    FILE1 file = YC_FAT_SeekFile(filepath);
+    if(0 == file.fdi_info_t.fdi_sec) return DEFRAG_PARAM_ERR;
+    ctx->fdi_sec = file.fdi_info_t.fdi_sec;
+    ctx->fdi_off = file.fdi_info_t.fdi_off;
+    ctx->old_clu = file.FirstClu;
+    ctx->fl_sz = file.fl_sz;
+    ctx->gen = mod_gen;
+    ctx->buf = (unsigned char *)buf;
+    ctx->buf_secs = buf_sz/PER_SECSIZE;
+#if MAX_OPEN_FILES
+    if(YC_FAT_FileIsOpen(&file)) return DEFRAG_OPENED_ERR;
+#endif
+    runs = YC_FAT_ChainRuns(ctx->old_clu,&n);
+    if(runs < 0) return DEFRAG_CHAIN_ERR;
+    if(runs <= 1) return 0;
+#if YC_FAT_DEFER_FREE
+    /* 先回收延后释放的簇链，增大可用的连续区间 */
+    while(YC_FAT_Idle());
+#endif
+    if(n > FatInitArgs_a[0].FreeClusNum) return DEFRAG_NO_EXTENT_ERR;
+    ctx->dst = YC_FAT_ScanFreeExtents(n,NULL,0,NULL);
+    if(!ctx->dst) return DEFRAG_NO_EXTENT_ERR;
+    ctx->nclus = n;
+    ctx->src = ctx->old_clu;
+    /* 占用目标区间 */
+    YC_FAT_ClaimExtent(ctx->dst,n);
+    YC_FAT_Commit();
+    return 1;
+}
+
+/* 碎片整理单步，最多迁移max_clus个簇后返回，适合在空闲任务中分片调用 */
+/* 返回剩余待迁移簇数，0表示整理完成，负数为错误码（DEFRAG_OPENED_ERR时上下文保留，可稍后重试） */
+/* 全部迁移后只改写一次目录项首簇作为提交点，之后再释放原簇链；文件在整理期间不能打开 */
+int YC_FAT_DefragStep(yc_defrag_t *ctx,unsigned int max_clus)
+{
+    unsigned int lim,r,c,nxt,k,m,total,cnt = 0;
+    unsigned int spc = g_dbr[0].secPerClus;
+    unsigned short l16,h16;
+    int ret;
+    if((NULL == ctx) || !ctx->dst) return DEFRAG_PARAM_ERR;
+    ret = YC_FAT_DefragVerify(ctx);
+    if(ret) return ret;
+    while((ctx->done < ctx->nclus) && (cnt < max_clus))
+    {
+        /* 取源簇链中一段物理连续的簇，长度不超过缓冲区和本次配额 */
+        lim = MAX(1,ctx->buf_secs/spc);
+        lim = MIN(lim,ctx->nclus-ctx->done);
+        lim = MIN(lim,max_clus-cnt);
+        c = ctx->src;
+        for(r = 1;;r++)
+        {
+            nxt = YC_TakefileNextClu(c) & 0x0fffffff;
+            if((r == lim) || (nxt != c+1)) break;
+            c = nxt;
+        }
+        /* 按缓冲区大小分块搬运 */
+        total = r*spc;
+        for(k = 0;k < total;k += m)
+        {
+            m = MIN(ctx->buf_secs,total-k);
+            YC_FAT_DevRead(ctx->buf,START_SECTOR_OF_FILE(ctx->src)+k,m);
+            YC_FAT_DevWrite(ctx->buf,START_SECTOR_OF_FILE(ctx->dst)+ctx->done*spc+k,m);
+        }
+        ctx->done += r;
+        cnt += r;
+        ctx->src = nxt;
+    }
+    if(ctx->done < ctx->nclus)
+        return ctx->nclus-ctx->done;
+
+    /* 提交：改写目录项首簇，单扇区写入，掉电时文件要么在原簇链要么在新区间 */
+    YC_FAT_DevRead(buffer1,ctx->fdi_sec,1);
+    l16 = ctx->dst;
+    h16 = ctx->dst >> 16;
+    Value2Byte2(&h16,buffer1+ctx->fdi_off+20);
+    Value2Byte2(&l16,buffer1+ctx->fdi_off+26);
+    YC_FAT_DevWrite(buffer1,ctx->fdi_sec,1);
+#if FILE_CACHE
+    /* 缓存的尾簇属于原簇链，改为新区间，整理后的簇链只有一个区段 */
+    {
+        FileCacheEntry *e = YC_FAT_CachePut(ctx->fdi_sec,ctx->fdi_off,ctx->dst,ctx->dst+ctx->nclus-1,ctx->fl_sz);
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+        e->ext[0].clu = ctx->dst;e->ext[0].num = ctx->nclus;
+        e->ext_n = 1;
+#else
+        (void)e;
+#endif
+    }
+#endif
+    /* 释放原簇链 */
+#if YC_FAT_DEFER_FREE
+    YC_FAT_DeferFree(ctx->old_clu);
+#else
+    YC_FAT_FreeChain(ctx->old_clu);
+#endif
+    ctx->dst = 0;
+    return 0;
+}
+#endif
+
+#if YC_FAT_PREALLOC
+/* 预分配错误码 */
+#define PREALLOC_PARAM_ERR -1
+#define PREALLOC_NO_EXTENT_ERR -2 /* 没有足够大的连续空闲区间 */
+
+/* 判断[start,start+n)是否全部空闲 */
+static unsigned char YC_FAT_ExtentIsFree(unsigned int start,unsigned int n)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int c;
+    if(start+n > CLU_END()) return 0;
+    for(c = start;c < start+n;c++)
+        if(0 != (YC_TakefileNextClu_Cached(c,&fat_sec,&cached_sec) & 0x0fffffff)) return 0;
+    return 1;
+}
+
+/* 从goal开始向后最多扫描GOAL_SCAN个FAT扇区，返回第一个长度不小于need的空闲区间首簇，找不到返回0 */
+static unsigned int YC_FAT_ScanFreeNear(unsigned int goal,unsigned int need)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu,run_s = 0,end = CLU_END();
+    if((goal < 2) || (goal >= end)) return 0;
+    end = MIN(end,goal+GOAL_SCAN*(PER_SECSIZE/FAT_SIZE));
+    for(clu = goal;clu < end;clu++)
+    {
+        if(0 != (YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff))
+        {
+            run_s = 0;
+            continue;
+        }
+        if(!run_s) run_s = clu;
+        if(clu-run_s+1 >= need) return run_s;
+    }
+    return 0;
+}
+
+/* 分配目标簇：有簇链时为簇链末簇之后，空文件为目录项所在的目录簇之后 */
+static unsigned int YC_FAT_GoalClu(FILE1 *fl,unsigned int tail)
+{
+    if(tail) return tail+1;
+    if(fl->fdi_info_t.fdi_sec < FatInitArgs_a[0].FirstDirSector) return 0;
+    return (fl->fdi_info_t.fdi_sec-FatInitArgs_a[0].FirstDirSector)/g_dbr[0].secPerClus+3;
+}
+
+/* 在预分配簇（或文件尾簇）之后再预分配need个连续簇，不提交 */
+/* 依次尝试：紧接簇链末尾、簇链末尾或父目录簇附近，anywhere非0时再找全盘第一段足够大的空闲区间 */
+static int YC_FAT_PreallocClus(FILE1 *fl,unsigned int need,unsigned char anywhere)
+{
+    unsigned int tail,dst;
+    unsigned short l16,h16;
+#if YC_FAT_DEFER_FREE
+    while((need > FatInitArgs_a[0].FreeClusNum) && YC_FAT_Idle());
+#endif
+    if(need > FatInitArgs_a[0].FreeClusNum) return PREALLOC_NO_EXTENT_ERR;
+    /* 簇链当前的末簇，空文件为0 */
+    tail = fl->PreNum ? fl->PreEnd : (fl->fl_sz ? fl->EndClu : 0);
+    if(tail && YC_FAT_ExtentIsFree(tail+1,need)) dst = tail+1;
+    else if((0 == (dst = YC_FAT_ScanFreeNear(YC_FAT_GoalClu(fl,tail),need))) && anywhere)
+        dst = YC_FAT_ScanFreeExtents(need,NULL,0,NULL);
+    if(!dst) return PREALLOC_NO_EXTENT_ERR;
+
+    /* 占用区间并接到簇链末尾，空文件写入目录项首簇 */
+    YC_FAT_ClaimExtent(dst,need);
+    if(tail) YC_FAT_ExpandCluChain(tail,dst);
+    else
+    {
+        l16 = dst;
+        h16 = dst >> 16;
+        YC_FAT_DevRead(buffer1,fl->fdi_info_t.fdi_sec,1);
+        Value2Byte2(&h16,buffer1+fl->fdi_info_t.fdi_off+20);
+        Value2Byte2(&l16,buffer1+fl->fdi_info_t.fdi_off+26);
+        YC_FAT_QueueWrite(buffer1,fl->fdi_info_t.fdi_sec);
+        fl->CurClus_R = fl->FirstClu = dst;
+    }
+    if(!fl->PreNum) fl->PreClu = dst;
+    fl->PreEnd = dst+need-1;
+    fl->PreNum += need;
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    YC_FAT_ExtentsInvalidate(fl);
+#endif
+#if YC_FAT_DEFRAG
+    YC_FAT_NoteModify(fl);
+#endif
+    return 0;
+}
+
+/* 预分配，为打开的文件一次性占用一段连续簇，使文件增长到bytes字节前不再分配和缝合簇链，文件大小不变 */
+/* 优先使用紧接文件末尾的簇，其次为磁盘上第一段足够大的空闲区间 */
+/* 预分配簇链接在文件尾簇之后，关闭文件时释放未用完的部分 */
+/* 关闭前掉电时簇链比文件大小长，重新打开时按文件大小定位尾簇，多出的簇接管为预分配簇，关闭时释放 */
+/* 返回0成功（已有空间足够时直接返回0），负数为错误码 */
+int YC_FAT_Preallocate(FILE1 *fl,unsigned int bytes)
+{
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int have,need;
+    if((NULL == fl) || (FILE_OPEN != fl->file_state)) return PREALLOC_PARAM_ERR;
+    have = fl->fl_sz/clu_size + ((fl->fl_sz%clu_size) ? 1 : 0) + fl->PreNum;
+    need = bytes/clu_size + ((bytes%clu_size) ? 1 : 0);
+    if(need <= have) return 0;
+    if(0 != YC_FAT_PreallocClus(fl,need-have,1)) return PREALLOC_NO_EXTENT_ERR;
+    YC_FAT_Commit();
+    return 0;
+}
+
+/* 释放文件未用完的预分配簇，簇链在文件尾簇处截断 */
+static void YC_FAT_TrimPrealloc(FILE1 *fl)
+{
+    if(!fl->PreNum) return;
+    if(fl->fl_sz)
+        YC_FAT_ExpandCluChain(fl->EndClu,0x0fffffff);
+    else
+    {
+        /* 空文件，目录项首簇清零 */
+        YC_FAT_DevRead(buffer1,fl->fdi_info_t.fdi_sec,1);
+        *(buffer1+fl->fdi_info_t.fdi_off+20) = *(buffer1+fl->fdi_info_t.fdi_off+21) = 0;
+        *(buffer1+fl->fdi_info_t.fdi_off+26) = *(buffer1+fl->fdi_info_t.fdi_off+27) = 0;
+        YC_FAT_QueueWrite(buffer1,fl->fdi_info_t.fdi_sec);
+        fl->FirstClu = 0;
+    }
+    /* 预分配簇从未写入数据，直接归还分配器，不擦除也不延后回收 */
+    YC_FAT_ReleaseChain(fl->PreClu,0);
+    fl->PreClu = fl->PreEnd = fl->PreNum = 0;
+#if MAX_OPEN_FILES && OPEN_EXTENTS
+    YC_FAT_ExtentsInvalidate(fl);
+#endif
+#if YC_FAT_DEFRAG
+    YC_FAT_NoteModify(fl);
+#endif
+}
+#endif
+
+#if YC_FAT_DELALLOC
+/* 延迟分配，追加写的数据暂存在内存中，暂存区满、YC_FAT_Flush或关闭文件时才分配簇并写入 */
+/* 每次下发按下发后的文件大小一次性分配一段连续簇，多个文件交替写入时各自的簇仍然连续 */
+/* 延迟分配错误码 */
+#define DELALLOC_PARAM_ERR -1
+#define DELALLOC_HEAP_ERR -2
+
+/* 开启延迟分配，buf为NULL时从堆中分配sz字节，sz取簇大小的整数倍效果最好 */
+int YC_FAT_SetDelalloc(FILE1 *fl,void *buf,unsigned int sz)
+{
+    if((NULL == fl) || (FILE_OPEN != fl->file_state) || (NULL != fl->da_buf) || !sz)
+        return DELALLOC_PARAM_ERR;
+#if YC_FAT_DIRECT_IO
+    if(fl->oflag & YC_O_DIRECT) return DELALLOC_PARAM_ERR;
+#endif
+    if(NULL == buf)
+    {
+        buf = tAllocHeapforeach(sz);
+        if(NULL == buf) return DELALLOC_HEAP_ERR;
+        fl->da_own = 1;
+    }
+    else
+        fl->da_own = 0;
+    fl->da_buf = (unsigned char *)buf;
+    fl->da_sz = sz;
+    fl->da_len = 0;
+    return 0;
+}
+
+/* 按写入后的文件大小预分配连续簇再写入，簇链只缝合一次；没有足够长的连续区间时按普通方式分配 */
+/* 只在文件末尾或父目录附近就近预分配，不到全盘寻找大区间，避免把交替写入的文件打散 */
+static int YC_FAT_DelallocAppend(FILE1 *fl,unsigned char *d_buf,unsigned int len)
+{
+#if YC_FAT_PREALLOC
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int have,need;
+    have = fl->fl_sz/clu_size + ((fl->fl_sz%clu_size) ? 1 : 0) + fl->PreNum;
+    need = (fl->fl_sz+len)/clu_size + (((fl->fl_sz+len)%clu_size) ? 1 : 0);
+    if(need > have) YC_FAT_PreallocClus(fl,need-have,0);
+#endif
+    return YC_WriteDataCheck(fl,d_buf,len);
+}
+
+/* 下发暂存数据，失败时数据留在暂存区 */
+static int YC_FAT_DelallocFlush(FILE1 *fl)
+{
+    int ret;
+    if(!fl->da_len) return 0;
+    ret = YC_FAT_DelallocAppend(fl,fl->da_buf,fl->da_len);
+    if(!ret) fl->da_len = 0;
+    return ret;
+}
+
+/* 延迟分配写，放不下时先下发暂存数据，不小于暂存区的数据直接写入 */
+static int YC_FAT_DelallocWrite(FILE1 *fl,unsigned char *d_buf,unsigned int len)
+{
+    int ret;
+    if(!len) return WRITE_FILE_LENGTH_WARN;
+    if(fl->da_len+len > fl->da_sz)
+    {
+        ret = YC_FAT_DelallocFlush(fl);
+        if(ret) return ret;
+    }
+    if(len >= fl->da_sz)
+        return YC_FAT_DelallocAppend(fl,d_buf,len);
+    YC_MemCpy(fl->da_buf+fl->da_len,d_buf,len);
+    fl->da_len += len;
+    return 0;
+}
+
+/* 下发文件暂存的数据和元数据 */
+int YC_FAT_Flush(FILE1 *fl)
+{
+    int ret;
+    if((NULL == fl) || (FILE_OPEN != fl->file_state)) return DELALLOC_PARAM_ERR;
+    ret = YC_FAT_DelallocFlush(fl);
+    YC_FAT_Commit();
+    return ret;
+}
+
+/* 关闭文件时下发暂存数据并释放暂存区，下发失败时返回错误码，暂存区保留 */
+static int YC_FAT_DelallocClose(FILE1 *fl)
+{
+    int ret = YC_FAT_DelallocFlush(fl);
+    if(ret) return ret;
+    if(fl->da_own) tFreeHeapforeach((void *)fl->da_buf);
+    fl->da_buf = NULL;
+    fl->da_sz = fl->da_len = 0;
+    fl->da_own = 0;
+    return 0;
+}
+#endif
+
+#if YC_FAT_RING
+/* 环形文件，创建时一次性分配全部连续簇，之后的读写只在簇链内回绕，不再修改FAT和FSINFO */
+/* 文件第一个扇区为头扇区，记录容量、写位置和有效数据量，其余扇区为数据区 */
+/* 头扇区只在YC_FAT_RingSync时写入，两次同步之间掉电会丢失这段时间写入的记录 */
+/* 打开期间登记在打开文件表中，删除、磁盘检查修复和碎片整理不会改动其簇链，用完须调用YC_FAT_RingClose */
+typedef struct {
+    struct fdi_info fdi;    /* 目录项位置 */
+    unsigned int hdr_sec;   /* 头扇区 */
+    unsigned int sec0;      /* 数据区首扇区 */
+    unsigned int cap;       /* 数据区容量（字节，扇区对齐） */
+    unsigned int head;      /* 下一写入位置 */
+    unsigned int used;      /* 有效数据量，最旧的数据在head-used处 */
+    unsigned char sec_buf[MAX_SECSIZE];/* 未写满的头部扇区 */
+}yc_ring_t;
+/* 环形文件错误码 */
+#define RING_PARAM_ERR -1
+#define RING_NO_SPACE_ERR -2    /* 没有足够大的连续空闲区间 */
+#define RING_FORMAT_ERR -3      /* 不是环形文件或簇链不连续 */
+#define RING_CREATE_ERR -4      /* 创建文件失败，文件已存在或路径错误 */
+#define RING_OPEN_TAB_ERR -5    /* 打开文件表已满 */
+/* 头扇区格式 */
+#define RING_MAGIC "YCRING01"
+#define RING_OFF_CAP 8
+#define RING_OFF_HEAD 12
+#define RING_OFF_USED 16
+
+/* 创建环形文件，数据区容量不小于size字节（按簇向上取整） */
+int YC_FAT_RingCreate(unsigned char *filepath,unsigned int size)
+{
+    FILE1 fl = {0};
+    unsigned int cap,v = 0;
+    if((NULL == filepath) || !size) return RING_PARAM_ERR;
+    if(CRT_FILE_OK != YC_FAT_CreateFile(filepath)) return RING_CREATE_ERR;
+    if(NULL == YC_FAT_OpenFile(&fl,filepath)) return RING_CREATE_ERR;
+    if((size > 0xffffffff-PER_SECSIZE) || (0 != YC_FAT_Preallocate(&fl,size+PER_SECSIZE)))
+    {
+        /* 空间不足，删除刚创建的空文件 */
+        YC_FAT_Close(&fl);
+        YC_FAT_Del_File(filepath);
+        return RING_NO_SPACE_ERR;
+    }
+    /* 预分配簇全部转为文件数据，关闭时不再释放 */
+    fl.fl_sz = fl.PreNum*PER_SECSIZE*g_dbr[0].secPerClus;
+    fl.EndClu = fl.PreEnd;
+    fl.PreClu = fl.PreEnd = fl.PreNum = 0;
+    cap = fl.fl_sz-PER_SECSIZE;
+    /* 写头扇区 */
+    YC_Memset(buffer2,0,PER_SECSIZE);
+    YC_ConstMem_l(buffer2,(const unsigned char *)RING_MAGIC,8);
+    Value2Byte4(&cap,buffer2+RING_OFF_CAP);
+    Value2Byte4(&v,buffer2+RING_OFF_HEAD);
+    Value2Byte4(&v,buffer2+RING_OFF_USED);
+    YC_FAT_DevWrite(buffer2,START_SECTOR_OF_FILE(fl.FirstClu),1);
+    /* 更新文件目录项FDI中的文件大小 */
+    YC_FAT_DevRead(buffer1,fl.fdi_info_t.fdi_sec,1);
+    if(Value2Byte4Dirty((unsigned int *)&fl.fl_sz,buffer1+fl.fdi_info_t.fdi_off+28))
+        YC_FAT_QueueWrite(buffer1,fl.fdi_info_t.fdi_sec);
+    YC_FAT_Close(&fl);
+    return 0;
+}
+
+/* 打开环形文件，读出头扇区，数据区按扇区号直接换算，读写不再访问FAT */
+int YC_FAT_RingOpen(yc_ring_t *r,unsigned char *filepath)
+{
+    FAT32_Sec_t fat_sec;unsigned int cached_sec = 0;
+    unsigned int clu_size = PER_SECSIZE*g_dbr[0].secPerClus;
+    unsigned int nclus,clu,i;
+    if((NULL == r) || (NULL == filepath)) return RING_PARAM_ERR;
+    FILE1 file = YC_FAT_SeekFile(filepath);
+    if(!file.FirstClu) return RING_PARAM_ERR;
+    /* 簇链必须连续 */
+    nclus = file.fl_sz/clu_size + ((file.fl_sz%clu_size) ? 1 : 0);
+    for(clu = file.FirstClu,i = 1;i < nclus;i++,clu++)
+        if((YC_TakefileNextClu_Cached(clu,&fat_sec,&cached_sec) & 0x0fffffff) != clu+1)
+            return RING_FORMAT_ERR;
+    r->hdr_sec = START_SECTOR_OF_FILE(file.FirstClu);
+    r->sec0 = r->hdr_sec+1;
+    YC_FAT_DevRead(buffer2,r->hdr_sec,1);
+    for(i = 0;i < 8;i++)
+        if(buffer2[i] != RING_MAGIC[i]) return RING_FORMAT_ERR;
+    r->cap = Byte2Value(buffer2+RING_OFF_CAP,4);
+    r->head = Byte2Value(buffer2+RING_OFF_HEAD,4);
+    r->used = Byte2Value(buffer2+RING_OFF_USED,4);
+    if(!r->cap || (r->cap%PER_SECSIZE) || (r->cap > file.fl_sz-PER_SECSIZE) || \
+        (r->head >= r->cap) || (r->used > r->cap))
+        return RING_FORMAT_ERR;
+    /* 登记到打开文件表，表满时打开失败 */
+    if(0 != YC_FAT_OpenTabAdd(&file)) return RING_OPEN_TAB_ERR;
+    r->fdi = file.fdi_info_t;
+    if(r->head%PER_SECSIZE)
+        YC_FAT_DevRead(r->sec_buf,r->sec0+r->head/PER_SECSIZE,1);
+    return 0;
+}
+
+/* 写环形文件，数据写满后覆盖最旧的数据，len超过容量时只保留最后cap字节 */
+/* 整扇区直接写入，不足一扇区的部分在sec_buf中累积，写满一扇区才下发，返回写入字节数 */
+int YC_FAT_RingWrite(yc_ring_t *r,unsigned char *d_buf,unsigned int len)
+{
+    unsigned int off,n,secs,ret = len;
+    if((NULL == r) || (NULL == d_buf) || !r->cap) return RING_PARAM_ERR;
+    if(len > r->cap)
+    {
+        d_buf += len-r->cap;
+        len = r->cap;
+    }
+    while(len)
+    {
+        off = r->head%PER_SECSIZE;
+        if(off || (len < PER_SECSIZE))
+        {
+            /* 开始一个新的不完整扇区时先读出，保留扇区后部尚未被覆盖的旧数据 */
+            if(!off) YC_FAT_DevRead(r->sec_buf,r->sec0+r->head/PER_SECSIZE,1);
+            n = MIN(PER_SECSIZE-off,len);
+            YC_MemCpy(r->sec_buf+off,d_buf,n);
+            if(off+n == PER_SECSIZE)
+                YC_FAT_DevWrite(r->sec_buf,r->sec0+r->head/PER_SECSIZE,1);
+        }
+        else
+        {
+            /* 整扇区直接写，到数据区末尾时回绕 */
+            secs = MIN(len/PER_SECSIZE,(r->cap-r->head)/PER_SECSIZE);
+            n = secs*PER_SECSIZE;
+            YC_FAT_DevWrite(d_buf,r->sec0+r->head/PER_SECSIZE,secs);
+        }
+        d_buf += n;len -= n;
+        r->head += n;
+        if(r->head == r->cap) r->head = 0;
+        r->used = MIN(r->used+n,r->cap);
+    }
+    return ret;
+}
+
+/* 从最旧的数据开始读环形文件，读出的数据被消费，返回读出字节数 */
+int YC_FAT_RingRead(yc_ring_t *r,unsigned char *d_buf,unsigned int len)
+{
+    unsigned int pos,off,n,secs,ret;
+    unsigned char *src;
+    if((NULL == r) || (NULL == d_buf) || !r->cap) return RING_PARAM_ERR;
+    ret = len = MIN(len,r->used);
+    pos = (r->head+r->cap-r->used)%r->cap;
+    while(len)
+    {
+        off = pos%PER_SECSIZE;
+        if(off || (len < PER_SECSIZE))
+        {
+            /* 未写满的头部扇区还在sec_buf中 */
+            if((r->head%PER_SECSIZE) && (pos/PER_SECSIZE == r->head/PER_SECSIZE))
+                src = r->sec_buf;
+            else
+            {
+                YC_FAT_DevRead(buffer2,r->sec0+pos/PER_SECSIZE,1);
+                src = buffer2;
+            }
+            n = MIN(PER_SECSIZE-off,len);
+            YC_MemCpy(d_buf,src+off,n);
+        }
+        else
+        {
+            secs = MIN(len/PER_SECSIZE,(r->cap-pos)/PER_SECSIZE);
+            n = secs*PER_SECSIZE;
+            YC_FAT_DevRead(d_buf,r->sec0+pos/PER_SECSIZE,secs);
+        }
+        d_buf += n;len -= n;
+        pos += n;
+        if(pos == r->cap) pos = 0;
+        r->used -= n;
+    }
+    return ret;
+}
+
+/* 同步环形文件，写入未写满的头部扇区和头扇区，关闭前或需要持久化时调用 */
+int YC_FAT_RingSync(yc_ring_t *r)
+{
+    if((NULL == r) || !r->cap) return RING_PARAM_ERR;
+    if(r->head%PER_SECSIZE)
+        YC_FAT_DevWrite(r->sec_buf,r->sec0+r->head/PER_SECSIZE,1);
+    YC_FAT_DevRead(buffer2,r->hdr_sec,1);
+    Value2Byte4(&r->head,buffer2+RING_OFF_HEAD);
+    Value2Byte4(&r->used,buffer2+RING_OFF_USED);
+    YC_FAT_DevWrite(buffer2,r->hdr_sec,1);
+    return 0;
+}
+
+/* 关闭环形文件，先同步再从打开文件表注销 */
+int YC_FAT_RingClose(yc_ring_t *r)
+{
+    FILE1 fl;
+    if((NULL == r) || !r->cap) return RING_PARAM_ERR;
+    YC_FAT_RingSync(r);
+    fl.fdi_info_t = r->fdi;
+    YC_FAT_OpenTabDel(&fl);
+    r->cap = 0;
+    return 0;
+}
+#endif
+
+/* 删除文件 */
+int YC_FAT_Del_File(unsigned char *file_path)
+{
+    if(NULL == file_path) return 0;
+    FILE1 file = YC_FAT_SeekFile(file_path);
+    /* 空文件首簇为0，按目录项位置判断文件是否存在 */
+    if((0 == file.fdi_info_t.fdi_sec) || (file.FirstClu && (file.FirstClu <= 2))){
+#if YC_FAT_DEBUG
+		printf("需要删除的文件不存在\r\n");
+#endif
+		return DEL_FILE_OPENED_ERR;
+	}
+	if(YC_FAT_FileIsOpen(&file))
+	{
+#if YC_FAT_DEBUG
+		printf("文件已打开，删除失败\r\n");
+#endif
+		return -2;
+	}
+#if YC_FAT_ASYNC_IO
+	if(YC_FAT_AioBusy(&file))
+		return AIO_BUSY_ERR;
+#endif
+    if(!file.FirstClu){
+        /* 修改此文件的文件目录项的部分字段 */
+        YC_FAT_DevRead(buffer1,file.fdi_info_t.fdi_sec,1);
+		*(buffer1+file.fdi_info_t.fdi_off) = 0xE5;//FDI第一个字节标记为0xE5
+#if 1 /* 这一步不清楚需不需要 */
+		*(buffer1+file.fdi_info_t.fdi_off+20) = *(buffer1+file.fdi_info_t.fdi_off+21) = 0;//FDI高位簇两字节标记为0x00
+#endif
+        YC_FAT_DevWrite(buffer1,file.fdi_info_t.fdi_sec,1);
+        return 0;
+    }
+	/* 修改此文件的文件目录项的部分字段 */
+    YC_FAT_DevRead(buffer1,file.fdi_info_t.fdi_sec,1);
+	*(buffer1+file.fdi_info_t.fdi_off) = 0xE5;//FDI第一个字节标记为0xE5
+	*(buffer1+file.fdi_info_t.fdi_off+20) = *(buffer1+file.fdi_info_t.fdi_off+21) = 0;//FDI高位簇两字节标记为0x00
+    YC_FAT_DevWrite(buffer1,file.fdi_info_t.fdi_sec,1);
+#if FILE_CACHE
+    /* 目录项可能被新文件复用，缓存的簇链信息作废 */
+    YC_FAT_CacheDrop(file.fdi_info_t.fdi_sec,file.fdi_info_t.fdi_off);
+#endif
+	/* 销毁簇链 */
+#if YC_FAT_DEFER_FREE
+    /* 簇链延后回收，删除操作立即返回 */
+    YC_FAT_DeferFree(file.FirstClu);
+#else
+    YC_FAT_FreeChain(file.FirstClu);
+#endif
+	return 0;
+}
+
+/* 重命名文件,file_name路径可以是任意路径 */
+int YC_FAT_RenameFile(unsigned char *file_path,unsigned char *file_name)
+{
+	if(NULL == file_path) return -1;
+	FILE1 file = YC_FAT_SeekFile(file_path);
+	    if(file.fdi_info_t.fdi_sec == 0){
+#if YC_FAT_DEBUG
+		printf("需要重命名的文件不存在\r\n");
+#endif
+		return -1;
+	}
+	unsigned char fn[11] = {0};
+	/* file_name预处理 */
+	unsigned char fp[50] = {0};
+	DelexcSpace(file_name,fp);
+	unsigned char f_n[20] = {0};
+	if(!YC_FAT_TakeFN(fp,f_n)) return -2;
+	if(!IS_FILENAME_ILLEGAL(f_n)) return -3;
+	/* 修改文件目录项中的文件名 */
+    YC_FAT_DevRead(buffer1,file.fdi_info_t.fdi_sec,1);
+	Genfilename_s(f_n,fn);
+    YC_StrCpy_l((unsigned char *)buffer1+file.fdi_info_t.fdi_off,fn,sizeof(fn));/* re-fill file name */
+    YC_FAT_DevWrite(buffer1,file.fdi_info_t.fdi_sec,1);
+	return 0;
+}
+
+/* 重命名目录,newdir路径可以是任意路径 */
+int YC_FAT_RenameDir(unsigned char *dir_path,unsigned char *newdir)
+{
+    unsigned int dir_clu;
+    unsigned char len1,len2;
+    FILE1 file;
+	/* dir_path预处理 */
 	unsigned char dp[50] = {0};
 	DelexcSpace(dir_path,dp);
     len1 = YC_StrLen(dp);
@@ -3219,10 +6038,10 @@ int YC_FAT_RenameDir(unsigned char *dir_path,unsigned char *newdir)
         if(!IS_FILENAME_ILLEGAL(d_n)) return -3;
 
         /* 修改文件目录项中的文件名 */
-        usr_read(buffer1,file.fdi_info_t.fdi_sec,1);
+        YC_FAT_DevRead(buffer1,file.fdi_info_t.fdi_sec,1);
         Genfilename_s(d_n,dp1);
         YC_StrCpy_l((unsigned char *)buffer1+file.fdi_info_t.fdi_off,dp1,sizeof(dp1));/* re-fill dir name */
-        usr_write(buffer1,file.fdi_info_t.fdi_sec,1);
+        YC_FAT_DevWrite(buffer1,file.fdi_info_t.fdi_sec,1);
         return 0;
     }
 #if YC_FAT_DEBUG
@@ -3263,15 +6082,22 @@ int YC_FAT_MakeFS(unsigned int DiskSecNum,enum PERCLUSZ perclusz)
     if(!SecPerClu)
         return NOTSUPPORTED_SIZE;
     unsigned int per_fatsz = GET_RCMD_FATSZ(DiskSecNum,SecPerClu);/* 每个fat表所占的扇区数 */
+#if YC_FAT_ERASE_ALIGN
+    /* 增加保留扇区使数据区起始扇区对齐擦除块，簇按擦除块边界排列 */
+    if(erase_blk > 1)
+        tmp_rsvd += (erase_blk - (DBR1_SEC_OFF+tmp_rsvd+2*per_fatsz)%erase_blk)%erase_blk;
+#endif
     /* 修改并写入dbr参数 */
     usr_clear(DBR1_SEC_OFF,1);/* DBR扇区清零 */
-    YC_ConstMem_l(buffer4,temp_fs_dbr,PER_SECSIZE);
+    YC_Memset(buffer4,0,sizeof(buffer4));
+    YC_ConstMem_l(buffer4,temp_fs_dbr,sizeof(temp_fs_dbr));/* 模板为512字节，大扇区时其余部分为0 */
     dbr = (DBR_t *)buffer4;
+    Value2Byte2(&g_secsz,(unsigned char *)&dbr->bytsPerSec);/* 修改每扇区字节数 */
     dbr->secPerClus = SecPerClu;/* 修改每簇扇区数 */
     Value2Byte4(&per_fatsz,(unsigned char *)&dbr->FATSz32);/* 修改每个fat表所占的扇区数 */
     Value2Byte2(&tmp_rsvd,(unsigned char *)&dbr->rsvdSecCnt);/* 修改保留扇区数 */
     Value2Byte4(&DiskSecNum,(unsigned char *)&dbr->totSec32);/* 修改总扇区数 */
-    usr_write(buffer4,DBR1_SEC_OFF,1);
+    YC_FAT_DevWrite(buffer4,DBR1_SEC_OFF,1);
     /* FAT表格式化 */
 #if FAT2_ENABLE
     usr_clear(DBR1_SEC_OFF+tmp_rsvd,2*per_fatsz);/* FAT表清零 */
@@ -3280,15 +6106,15 @@ int YC_FAT_MakeFS(unsigned int DiskSecNum,enum PERCLUSZ perclusz)
 #endif
     YC_Memset(buffer4,0,sizeof(buffer4));
     YC_ConstMem_l(buffer4,temp_fattable,sizeof(temp_fattable));/* 写入FAT表模板 */
-    usr_write(buffer4,DBR1_SEC_OFF+tmp_rsvd,1);
+    YC_FAT_DevWrite(buffer4,DBR1_SEC_OFF+tmp_rsvd,1);
 #if FAT2_ENABLE
-    usr_write(buffer4,DBR1_SEC_OFF+tmp_rsvd+per_fatsz,1);
+    YC_FAT_DevWrite(buffer4,DBR1_SEC_OFF+tmp_rsvd+per_fatsz,1);
 #endif
     /* 根目录簇清零并写入模板 */
     usr_clear(DBR1_SEC_OFF+tmp_rsvd+2*per_fatsz,SecPerClu);/* 根目录清零 */
     YC_Memset(buffer4,0,sizeof(buffer4));
     YC_ConstMem_l(buffer4,temp_rootdir,sizeof(temp_rootdir));
-    usr_write(buffer4,DBR1_SEC_OFF+tmp_rsvd+2*per_fatsz,1);
+    YC_FAT_DevWrite(buffer4,DBR1_SEC_OFF+tmp_rsvd+2*per_fatsz,1);
     /* FSINFO扇区格式化 */
     usr_clear(DBR1_SEC_OFF+1,1);/* FSINFO扇区清零 */
     YC_Memset(buffer4,0,sizeof(buffer4));
@@ -3296,7 +6122,7 @@ int YC_FAT_MakeFS(unsigned int DiskSecNum,enum PERCLUSZ perclusz)
     YC_ConstMem_l(buffer4+484,temp_fsinfo2,sizeof(temp_fsinfo2));
     Value2Byte4(&temp,buffer4+484);/* 修改当前分区剩余总空闲簇数 */
     Value2Byte4(&temp1,buffer4+488);/* 修改当前分区下一个空闲簇 */
-    usr_write(buffer4,DBR1_SEC_OFF+1,1);
+    YC_FAT_DevWrite(buffer4,DBR1_SEC_OFF+1,1);
     /* 新建回收站 */
 #if YC_FAT_RECYCLE
     /* 在根目录下创建回收站目录 */
@@ -3310,6 +6136,9 @@ int YC_FAT_MakeFS(unsigned int DiskSecNum,enum PERCLUSZ perclusz)
 int YC_FAT_FileCrop(FILE1 * fl,unsigned int len)
 {
 	if(!len) return 0;
+#if YC_FILE2MEM
+	if(NULL != fl->mem) return WRITE_FILE_MEM_ERR;/* 文件已加载至内存 */
+#endif
 	if(fl->fl_sz == 0) return 0;
 	if(len == fl->fl_sz) return 0;
     int cl;
@@ -3325,12 +6154,16 @@ int YC_FAT_FileCrop(FILE1 * fl,unsigned int len)
         
 	}
 update_fdi:
+#if FILE_CACHE
+    /* 尾簇和大小改变，缓存作废 */
+    YC_FAT_CacheDrop(fl->fdi_info_t.fdi_sec,fl->fdi_info_t.fdi_off);
+#endif
     /* 更新一些内存参数 */
     fl->fl_sz = fl->fl_sz - len;
     /* 修改FDI文件大小参数 */
-    usr_read(buffer4,fl->fdi_info_t.fdi_off,1);
+    YC_FAT_DevRead(buffer4,fl->fdi_info_t.fdi_off,1);
     Value2Byte4(&fl->fl_sz,buffer4+fl->fdi_info_t.fdi_sec+28);/* 修改文件大小 */
-    usr_write(buffer4,fl->fdi_info_t.fdi_off,1);
+    YC_FAT_DevWrite(buffer4,fl->fdi_info_t.fdi_off,1);
     /* 更新FSINFO */
     
     return 0;
@@ -3399,6 +6232,26 @@ int YC_FAT_Mount(unsigned char *drvn,ioopr_t *usrdev,char if_mkfs)
 	fatobj->ioopr.DeviceOpr_WR = usrdev->DeviceOpr_WR;
 	fatobj->ioopr.DeviceOpr_RD = usrdev->DeviceOpr_RD;
 	fatobj->ioopr.DeviceOpr_CLR = usrdev->DeviceOpr_CLR;
+#if YC_FAT_ASYNC_IO
+	fatobj->ioopr.DeviceOpr_WR_Async = usrdev->DeviceOpr_WR_Async;
+	fatobj->ioopr.DeviceOpr_RD_Async = usrdev->DeviceOpr_RD_Async;
+#endif
+#if YC_FAT_VECTOR_IO
+	fatobj->ioopr.DeviceOpr_WRV = usrdev->DeviceOpr_WRV;
+	fatobj->ioopr.DeviceOpr_RDV = usrdev->DeviceOpr_RDV;
+#endif
+#if FILE_CACHE && FCACHE_PERSIST
+	fatobj->ioopr.CacheSave = usrdev->CacheSave;
+	fatobj->ioopr.CacheLoad = usrdev->CacheLoad;
+#endif
+#if YC_FAT_ASYNC_IO || YC_FAT_VECTOR_IO
+	cur_ioopr = &fatobj->ioopr;
+#endif
+#if YC_FAT_ERASE_ALIGN
+	fatobj->ioopr.EraseBlkSecs = usrdev->EraseBlkSecs;
+	erase_blk512 = usrdev->EraseBlkSecs;
+	erase_blk = erase_blk512/(PER_SECSIZE/512);
+#endif
     /* 大小端检测 */
     endian_checker();
 #if YC_FAT_MKFS
@@ -3416,7 +6269,26 @@ int YC_FAT_Unmount(unsigned char *drvn)
 {
 	/* 从挂载链删除 */
 	struct list_head *pos;
+#if YC_FAT_ASYNC_IO
+	YC_FAT_AsyncWait();/* 等待未完成的异步请求，其完成时还要缝合簇链和更新FDI */
+#endif
+#if YC_FAT_WRQUEUE
+	batch_depth = 0;/* 结束未提交的批量事务 */
+#endif
+	YC_FAT_Sync();/* 回收延后释放的簇链并下发元数据 */
 	if(NULL != (pos = YC_FAT_MatchDdn(drvn))){
+		/* 写入空闲簇统计和提示，置正常卸载标志，下次挂载无需遍历FAT */
+		YC_FAT_UpdateFSInfo();
+		YC_FAT_SetVolClean(1);
+		YC_FAT_Commit();
+#if FILE_CACHE && FCACHE_PERSIST
+		/* 保存文件缓存，下次挂载时打开文件不再遍历簇链 */
+		YC_FAT_CacheSave(&((ycfat_t *)pos)->ioopr);
+#endif
+#if YC_FAT_ASYNC_IO || YC_FAT_VECTOR_IO
+		if(cur_ioopr == &((ycfat_t *)pos)->ioopr)
+			cur_ioopr = NULL;
+#endif
 		list_del(pos);
 		tFreeHeapforeach((void *)pos);
 		fatobjNodeNum --;
@@ -5,9 +5,103 @@
 #define YC_TIMEOUT_SWITCH   0
 #define YC_TIMESTAMP_ON 0
 
-/* 文件重定向至内存 */
+/* 支持的最大扇区大小，挂载时按DBR中的实际扇区大小访问，512/1024/2048/4096 */
+/* 所有扇区缓冲区按此大小分配，挂载4Kn介质或4K页NOR Flash时设为4096 */
+#define MAX_SECSIZE 512
+
+/* 文件重定向至内存，load2memory将整个文件读入内存，修改后用YC_FAT_MemDirty标记，Writeback只回写脏扇区 */
+/* 适用于反复读取的配置文件和查找表，加载后不再访问设备 */
 #define YC_FILE2MEM 1
 
+/* 直接I/O，扇区对齐的读写不经过内部缓冲区中转 */
+/* 适用于DMA传输的SD卡主控，偏移和长度不对齐时读写直接失败 */
+#define YC_FAT_DIRECT_IO 1
+
+/* 异步DMA读写，ioopr_t需提供异步读写接口，未提供时退化为同步读写 */
+/* 依赖YC_FAT_DIRECT_IO，读写偏移和长度必须扇区对齐 */
+#define YC_FAT_ASYNC_IO 1
+#if YC_FAT_ASYNC_IO
+/* 传输完成回调在中断中执行，移植时替换为关中断/开中断 */
+#define YC_FAT_ENTER_CRITICAL()
+#define YC_FAT_EXIT_CRITICAL()
+#endif
+
+/* 分散/聚集读写，ioopr_t需提供向量读写接口，未提供时逐段调用同步读写 */
+/* 一次文件读写的所有数据段合并为一个段表提交，便于支持命令队列的主控保持总线忙碌 */
+#define YC_FAT_VECTOR_IO 1
+#if YC_FAT_VECTOR_IO
+#define IOV_MAX_SEGS 8 /* 段表容量，超出时分多次提交 */
+#endif
+
+/* 元数据写队列，FAT/FDI/FSINFO扇区写先入队，按LBA排序后下发 */
+/* 相邻扇区合并为一次多扇区写，同一扇区在一次刷新窗口内的重复写只保留最后一次 */
+/* YC_FAT_BeginBatch/YC_FAT_CommitBatch之间的所有元数据更新在提交时一次下发 */
+#define YC_FAT_WRQUEUE 1
+#if YC_FAT_WRQUEUE
+#define WRQUEUE_DEPTH 8 /* 队列深度（扇区数），每个扇区占用MAX_SECSIZE字节RAM，批量事务超出时提前刷新 */
+#endif
+
+/* 延后回收，删除文件时只标记目录项，簇链在YC_FAT_Idle/YC_FAT_Sync中批量回收 */
+/* 回收前掉电只会丢失空闲空间，不会破坏文件，可由磁盘检查找回 */
+#define YC_FAT_DEFER_FREE 1
+#if YC_FAT_DEFER_FREE
+#define DEFER_FREE_NUM 8 /* 待回收簇链数，队列满时删除操作同步回收最早的一条 */
+#endif
+
+/* 释放簇时通知设备擦除/TRIM（usr_clear），物理相邻的释放簇合并为一次调用 */
+/* 擦除在释放的FAT写入设备之后、簇重新可分配之前下发，批量事务中释放的簇不擦除 */
+/* 0关闭 DISCARD_IMMEDIATE每条簇链释放后下发 DISCARD_BATCHED YC_FAT_Sync回收延后释放的簇链时合并为一次下发 */
+#define DISCARD_IMMEDIATE 1
+#define DISCARD_BATCHED 2
+#define YC_FAT_DISCARD DISCARD_BATCHED
+#if YC_FAT_DISCARD
+#define DISCARD_RANGES 8 /* 待擦除区间数，满时提前下发 */
+#endif
+
+/* 按擦除块对齐，适用于NOR Flash等擦除块大于扇区的设备，擦除块大小由ioopr_t.EraseBlkSecs给出 */
+/* 格式化时数据区对齐擦除块，新文件从空闲擦除块起始处分配，元数据合并写不跨擦除块 */
+#define YC_FAT_ERASE_ALIGN 1
+#if YC_FAT_ERASE_ALIGN
+#define ERASE_ALIGN_SCAN 4 /* 寻找空闲擦除块时最多扫描的FAT扇区数 */
+#endif
+
+/* 磁盘检查（YC_FAT_Check），查找丢失簇、交叉链接和FSINFO统计错误，可选修复 */
+/* 工作区由调用者提供，主机端链接本库并实现usr_read/usr_write读写镜像文件即可作为检查工具 */
+#define YC_FAT_CHECK 1
+#if YC_FAT_CHECK
+#define CHECK_MAX_DEPTH 16 /* 最大目录层数 */
+#endif
+
+/* 在线碎片整理（YC_FAT_DefragBegin/YC_FAT_DefragStep），把文件簇链迁移到一段连续空闲簇 */
+/* 每次调用迁移的簇数由调用者限定，可在空闲任务中分片执行；全部迁移后只改写一次目录项首簇，掉电不会损坏文件 */
+#define YC_FAT_DEFRAG 1
+#if YC_FAT_DEFRAG
+#define DEFRAG_MOD_LOG 8 /* 修改记录条数，整理期间修改过的文件超过此数时保守地放弃整理 */
+#endif
+
+/* 预分配（YC_FAT_Preallocate），为已知大小的文件一次性占用连续簇，文件大小不变 */
+/* 追加写先使用预分配簇，不再分配和缝合簇链；关闭文件时释放未用完的预分配簇 */
+#define YC_FAT_PREALLOC 1
+#if YC_FAT_PREALLOC
+#define RESV_WINDOW 16 /* 追加写分配簇时每个文件在尾簇后预留的连续簇数，多路同时写入时各自连续，0时只按需就近分配 */
+#define GOAL_SCAN 4 /* 分配时在文件尾簇或父目录簇之后就近寻找空闲区间最多扫描的FAT扇区数 */
+#endif
+
+/* 延迟分配（YC_FAT_SetDelalloc/YC_FAT_Flush），追加写的数据先暂存在内存中，下发时按总大小一次分配连续簇 */
+/* 多路同时录制时每个文件的簇各自连续；开启YC_FAT_PREALLOC时优先分配整段连续空闲区间 */
+#define YC_FAT_DELALLOC 1
+
+/* 环形文件（YC_FAT_RingCreate/RingWrite/RingRead），固定大小、创建时一次性分配连续簇，写满后覆盖最旧数据 */
+/* 读写只访问数据扇区，不修改FAT和FSINFO，适用于长期循环记录的日志；依赖YC_FAT_PREALLOC */
+#define YC_FAT_RING 1
+
+/* 文件令牌（YC_FAT_GetToken/YC_FAT_OpenByToken），保存目录项位置、首簇和尾簇 */
+/* 重新打开时只读一次目录项扇区校验，不解析路径、不查找目录、不遍历簇链，适用于频繁打开关闭的文件 */
+#define YC_FAT_FTOKEN 1
+
+/* 文件信息查询（YC_FAT_Stat/YC_FAT_Exists），只扫描目录项，不打开文件、不遍历簇链 */
+#define YC_FAT_STAT 1
+
 /* 支持字符编码功能 */
 #define YC_FAT_ENCODE 1
 
@@ -29,15 +123,21 @@
 #define FROMAT_STRATEGY_SET SFD/* 格式化策略选择 */
 #endif
 
-/* 文件信息缓存 */
-/* 适用于文件频繁打开关闭 */
+/* 文件信息缓存，按FDI位置散列、LRU淘汰，记录首簇、尾簇、大小和簇链区段 */
+/* 适用于文件频繁打开关闭，文件大小未变时重新打开不遍历簇链 */
 #define FILE_CACHE 1
 #if FILE_CACHE
-#define MAX_FILES_CACHE 5 /* 最大缓存 */
+#define MAX_FILES_CACHE 16 /* 最大缓存 */
+#define FCACHE_HASH_SIZE 8 /* 散列桶数，必须是2的幂 */
+#define FCACHE_PERSIST 1 /* 卸载时通过ioopr_t.CacheSave保存缓存，挂载时读回 */
 #endif
 
-/* 可同时打开的最大文件数量 */
-#define MAX_OPEN_FILES 5
+/* 可同时打开的最大文件数量（同一文件的多个句柄只占一项），打开文件表按FDI位置散列 */
+#define MAX_OPEN_FILES 16
+#if MAX_OPEN_FILES
+#define OPEN_HASH_SIZE 16 /* 散列桶数，必须是2的幂 */
+#define OPEN_EXTENTS 4 /* 每个打开文件共享的簇链区段表容量，0关闭，段数更多的文件随机访问时遍历FAT */
+#endif
 
 /* 文件裁剪 */
 #define YC_FAT_CROP 1